@@ -24,10 +24,17 @@ THIS SOFTWARE.
 #pragma once
 #include <assert.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include <vector>
+#include <map>
+#include <list>
+#include <unordered_map>
 #include <memory>
 #include <random>
-#include <regex>
+#include <bitset>
+#include <atomic>
+#include <awklib/awk.h>
 
 typedef double  Awkfloat;
 
@@ -46,10 +53,18 @@ extern int  dbg;
 
 #define  RECSIZE  (8 * 1024)  /* sets limit on records, fields, etc., etc. */
 #define  NSYMTAB  50  /* initial size of a symbol table */
+#define  INBUF_SIZE  (64 * 1024)  /* size of input blocks */
+#define  RA_BLOCKS  4  /* input blocks read ahead by a background thread */
+#ifndef MMAP_WINDOW
+/* largest part of an input file that can be mapped in memory at one time */
+#define  MMAP_WINDOW  ((size_t)(sizeof (void*) > 4 ? 1024 : 64) * 1024 * 1024)
+#endif
 
 
 class Array;
 class Node;
+class Dfa;
+class Program;
 
 /// Cell:  all information about a variable or constant
 class Cell {
@@ -71,28 +86,36 @@ public:
     BFALSE //false value
   };
 
-  Cell (const char *n=nullptr, type t=Cell::type::CELL, unsigned char flags=0, Awkfloat f = 0.);
+  Cell (const char *n=nullptr, type t=Cell::type::CELL, unsigned short flags=0, Awkfloat f = 0.);
   ~Cell ();
+  static void* operator new (size_t sz);
+  static void operator delete (void* p);
   Cell& operator =(const Cell& rhs);
   void setsval (const char* s);
   void setfval (Awkfloat f);
   const char* getsval ();
   Awkfloat getfval ();
+  bool isnum ();
   const char* getpssval ();
+  const char* getpssval (size_t& len);
+  void unview ();
   void clear ();
   void makearray (size_t sz = NSYMTAB);
-  bool match (const char* s, bool anchored=false);
-  bool pmatch (const char* s, size_t& start, size_t& len, bool anchored = false);
+  bool match (const char* s);
+  bool pmatch (const char* s, size_t& start, size_t& len, bool notbol = false);
 
   type ctype;           /* Cell type, see above */
-  unsigned char   flags;/* type flags */
+  unsigned short  flags;/* type flags */
 #define NUM       0x01  /* number value is valid */
 #define STR       0x02  /* string value is valid */
 #define CONVC     0x04  /* string was converted from number via CONVFMT */
 #define PREDEF    0x08  /* predefined variable*/
 #define ARR       0x10
 #define REGEX     0x20
+#define FVIEW     0x40  /* field string value is a view into $0 */
 #define CONST     0x80
+#define NCHK      0x100 /* string not yet checked for a numeric value */
+#define NCONV     0x200 /* string constant has its numeric value in fval */
 
   std::string nval;     /* name */
   std::string sval;     /* string value */
@@ -101,10 +124,13 @@ public:
     void* funptr;       /* pointer to external function body */
     Array* arrval;      /* reuse for array pointer */
     Node* nodeptr;      /* reuse for function pointer */
-    std::regex* re;     /* reuse for regex pointer*/
+    Dfa* re;            /* reuse for regex pointer*/
+    struct {
+      unsigned int off; /* offset in $0 */
+      unsigned int len; /* length */
+    } view;             /* field value when FVIEW flag is set */
   };
 
-  Cell *cnext;           /* ptr to next in arrays*/
 #ifndef NDEBUG
   int id;
 #endif
@@ -115,6 +141,7 @@ public:
   bool isnf () const { return ctype == type::CNF; }
 
   bool isregex () const { return (flags & REGEX) != 0; }
+  bool isview () const { return (flags & FVIEW) != 0; }
   bool isrec () const { return ctype == type::REC; }
   bool isnext () const  { return ctype == type::JNEXT || ctype == type::JNEXTFILE; }
   bool isret () const { return ctype == type::JRET; }
@@ -126,8 +153,7 @@ public:
   bool istemp () const { return ctype == type::CTEMP; }
 
 private:
-  std::string fmt;       /* CONVFMT/OFMT value used to convert from number */
-  void update_str_val ();
+  void update_str_val (const char* fmt);
 };
 
 class Array {    /* symbol table array */
@@ -143,8 +169,9 @@ public:
 
   private:
     Iterator (const Array* a);
+    void next ();
     const Array* owner;
-    int ipos;
+    size_t ipos;
     Cell* ptr;
     friend class Array;
   };
@@ -153,9 +180,13 @@ public:
   ~Array ();
   Cell* setsym (const char* n, const char* s, double f, unsigned int t);
   Cell* setsym (const char* n, Array* arr, int addl_flags);
+  Cell* setsym (size_t k, const char* s, double f, unsigned int t);
   Cell* removesym (const std::string& n);
+  Cell* removesym (size_t k);
   void deletecell (Iterator& p);
   Cell* lookup (const char* name);
+  Cell* lookup (const char* name, size_t len);
+  Cell* lookup (size_t k);
   int   length () const;
   int   size () const;
 
@@ -166,12 +197,25 @@ public:
 #endif
 
 private:
+  /// Hash table slot
+  struct Slot {
+    uint64_t hash;      //!< hash value of element name
+    Cell* cp;           //!< element or NULL if slot is empty
+  };
+  Cell* get (const char* n, size_t len, bool& added);
+  Cell* get (size_t k, bool& added);
+  bool growdense (size_t k);
+  size_t find (const char* s, size_t len, uint64_t h) const;
+  void place (Slot e);
   void rehash ();
-  Cell* insert_sym (const char* n);
-
-  int  nelem;     /* elements in table right now */
-  int  sz;        /* size of tab */
-  Cell  **tab;    /* hash table pointers */
+  Cell* insert_sym (const char* n, size_t len, uint64_t h);
+  void remove (size_t i);
+
+  int  nelem;     /* elements in hash table right now */
+  size_t mask;    /* size of tab - 1; size is a power of 2 */
+  Slot* tab;      /* hash table */
+  std::vector<Cell*> dense; /* elements with integer keys 0 to dense.size()-1 */
+  int  ndense;    /* elements in dense part */
 };
 
 /* function types */
@@ -225,7 +269,6 @@ typedef Node::pfun pfun;
 
 #define  NIL  ((Node *) 0)
 
-extern  int  pairstack[], paircnt;
 
 struct FILE_STRUC {
   FILE  *fp;
@@ -236,13 +279,229 @@ struct FILE_STRUC {
 typedef int (*inproc)();
 typedef int (*outproc)(const char *buf, size_t len);
 
+/// Block-buffered input stream
+class InputStream {
+public:
+  static InputStream* open (FILE* f, inproc in, bool async = false, size_t window = 0);
+#ifndef _MSC_VER
+  static InputStream* open (FILE* f, off_t start, off_t end, size_t window);
+#endif
+  InputStream (FILE* f, inproc in = nullptr, size_t bufsize = INBUF_SIZE);
+  virtual ~InputStream ();
+  bool getrec (std::string& rec, int sep);
+  bool getpara (std::string& rec);
+
+  FILE* fp;             //!< underlying file
+  inproc redir;         //!< input redirection function (if any)
+
+protected:
+  virtual size_t fill ();
+  char* buf;            //!< data buffer
+  const char* ptr;      //!< next unread character
+  const char* end;      //!< end of data in buffer
+  bool eof;             //!< end of input seen on last fill
+};
+
+/// Regular expression compiled into a lazily built DFA (see b.cpp)
+class Dfa {
+public:
+  Dfa (const char* re);
+  Dfa (const std::vector<std::string>& res);
+  bool match (const char* s, size_t len);
+  bool pmatch (const char* s, size_t len, size_t& start, size_t& mlen, bool notbol = false);
+  void matchall (const char* s, size_t len, std::vector<char>& found);
+
+private:
+  /// Syntax tree node
+  struct ReNode {
+    int type;           //!< node type
+    int left, right;    //!< children
+    int pos;            //!< position number of leaf nodes
+  };
+  int regexp ();
+  int branch ();
+  int piece ();
+  int atom ();
+  bool interval (int& n);
+  int bracket ();
+  int escape ();
+  int node (int type, int left = -1, int right = -1);
+  int leaf (int type, const std::bitset<256>& cs = std::bitset<256> ());
+  int clone (int n);
+  int endmark ();
+  void build (int anchored);
+  void follow (int anchored, int unanchored);
+  void error (const char* msg);
+  void literal (int r);
+  bool findlit (const char* s, size_t len, size_t& pos);
+  int prefilter (const char* s, size_t len, bool notbol, size_t& pos);
+
+  int step (int s, int c);
+  int addtrans (int s, int c);
+  int addstate (const std::vector<int>& set);
+  void flush ();
+  bool longest (const char* s, size_t len, size_t p, bool bol, size_t& end, size_t& steps);
+  Dfa (const Dfa& fwd, int root);
+  int reverse (const Dfa& fwd, int n);
+  bool leftmost (const char* s, size_t len, bool bol, size_t& start);
+
+  /// Reversed automaton, built when needed; copies build their own
+  struct Reversed : std::unique_ptr<Dfa> {
+    Reversed () {}
+    Reversed (const Reversed&) : std::unique_ptr<Dfa> () {}
+    Reversed& operator= (const Reversed&) { reset (); return *this; }
+  };
+
+  std::string src;                      //!< source expression
+  const char* rp;                       //!< parser position in source
+  int root;                             //!< syntax tree of expression (-1 if several)
+  std::vector<ReNode> tree;             //!< syntax tree
+  std::vector<int> ptype;               //!< type of each position
+  std::vector<std::bitset<256>> pchars; //!< characters matched by each position
+  std::vector<std::vector<int>> followpos;
+  std::vector<int> finals;              //!< end marker position of each expression
+  std::vector<int> afirst, ufirst;      //!< initial positions (anchored and not)
+  int aini, uini;                       //!< initial states (anchored and not)
+  std::string lit;                      //!< literal required in every match
+  int litflags;                         //!< where the literal occurs
+
+  std::map<std::vector<int>, int> states; //!< state numbers by position set
+  std::vector<std::vector<int>> sets;   //!< position set of each state
+  std::vector<int> trans;               //!< transitions (-1 if not computed yet)
+  std::vector<char> accept;             //!< accepting states
+  std::vector<std::vector<int>> matched; //!< expressions matched by each state
+  size_t maxstates;                     //!< flush state cache beyond this size
+  Reversed rev;                         //!< finds match starts for pmatch
+};
+
+/// Replacement string of sub() and gsub() split into text and `&` markers
+struct Repl {
+  void parse (const char* s);
+  void append (std::string& out, const char* m, size_t mlen) const;
+
+  std::string text;             //!< replacement text without `&` and escapes
+  std::vector<size_t> amp;      //!< positions in `text` where matched text goes
+};
+
+/// Finds field separators in a string, 64 characters at a time
+class SepScanner {
+public:
+  void reset (const char* s, size_t n, char c1, char c2, char c3);
+  size_t find (size_t i) { return next (i, true); }   ///< next separator
+  size_t skip (size_t i) { return next (i, false); }  ///< next non-separator
+  size_t size () const { return len; }
+
+private:
+  size_t next (size_t i, bool sep);
+  const char* str;      //!< string being scanned
+  size_t len;           //!< string length
+  char set[3];          //!< separator characters
+  size_t blk;           //!< start of block covered by mask
+  uint64_t mask;        //!< separator positions in current block
+};
+
 // Function call frame
 struct Frame {
   Cell *fcn;    //the function
-  Cell **args;  //arguments
+  size_t base;  //first argument slot in call stack
   int nargs;    //number of arguments
 };
 
+// Argument slot in call stack
+struct Slot {
+  Cell* arg;    //argument: own cell or array passed by reference
+  Cell* par;    //actual parameter or NULL if not supplied
+  std::unique_ptr<Cell> own; //cell reused by all calls using this slot
+};
+
+
+/*!
+  Bytecode compiled from a list of statements.
+
+  Statements and expressions the compiler knows about are turned into
+  instructions for a stack machine (see vm.cpp). Anything else stays a
+  reference to its parse tree node and is executed by the tree walker.
+*/
+class Code {
+public:
+  /// Variables seen by type inference; `true` if provably numeric
+  typedef std::unordered_map<const Cell*, bool> Vars;
+
+  Code (const Node* stmts, const Vars& numvars);
+  Cell* run ();
+  static void infer (const Node* n, Vars& vars);
+
+private:
+  /// Stack element: a cell or a plain number
+  union Value {
+    Cell* cp;
+    Awkfloat f;
+  };
+
+  /// One instruction
+  struct Instr {
+    const void* addr;   //!< handler address (direct threaded dispatch)
+    int op;             //!< operation code
+    int n;              //!< operator token or flag
+    int jmp;            //!< jump target, or `break` target for EXEC
+    int jmp2;           //!< `continue` target for EXEC
+    union {
+      Cell* cp;
+      const Node* np;
+      Awkfloat f;
+    };
+  };
+
+  /// Pending jumps out of a loop
+  struct Loop {
+    std::vector<int> brk;
+    std::vector<int> cont;
+  };
+
+  void stmts (const Node* n);
+  void stmt (const Node* n);
+  bool expr (const Node* n);
+  void cellexpr (const Node* n);
+  void numexpr (const Node* n);
+  void cond (const Node* n);
+  void loopend (int brk, int cont);
+  int emit (int op, int n = 0);
+  bool isnumvar (const Node* n) const;
+  bool store (const Node* n, bool push);
+
+  const Vars* vars;     //!< result of type inference (only while compiling)
+  std::vector<Instr> code;
+  std::vector<Loop> loops;
+  std::vector<Value> stack;
+  int depth;            //!< stack depth at current point of compilation
+  bool linked;          //!< `addr` fields are set
+};
+
+/*!
+  Slab allocator for Cell objects.
+
+  Cells are carved out of large slabs and freed cells are kept in a free
+  list. Each block remembers its slab, so a cell can be released no matter
+  which interpreter is current. If the pool is destroyed while some of
+  its cells are still alive, their slabs are freed when the last cell goes.
+*/
+class CellPool {
+public:
+  CellPool ();
+  ~CellPool ();
+  static void* alloc (CellPool* pool, size_t sz);
+  static void release (void* p);
+
+private:
+  struct Slab {
+    CellPool* owner;    //!< pool or NULL if pool was destroyed
+    size_t live;        //!< blocks in use
+    Slab* next;         //!< next slab of the same pool
+  };
+  void grow ();
+  Slab* slabs;          //!< all slabs of this pool
+  char* free_list;      //!< first free block
+};
 
 class Interpreter {
 public:
@@ -259,12 +518,17 @@ public:
   void initgetrec ();
   bool getrec (Cell* cell);
   void nextfile ();
-  int getchar (FILE* inf);
+  void prefetch ();
+  void dropnext ();
+  InputStream* instream (FILE* inf);
+  void closein (FILE* inf);
   bool readrec (Cell* cell, FILE* inf);
   const char* getargv (int n);
-  int putstr (const char* str, FILE* fp);
+  int putstr (const char* str, size_t len, FILE* fp);
   void setclvar (const char* s);
   void fldbld ();
+  void fldbld (int n);
+  void nfbld ();
   void recbld ();
   void cleanfld (int n1, int n2);
   void setlastfld (int n);
@@ -272,7 +536,21 @@ public:
   void growfldtab (size_t n);
   Node* nodealloc (int n);
   Cell* makedfa (const char* s);
-
+  void setrecache (size_t size);
+  void makecode ();
+  void runcode ();
+  Interpreter* clone ();
+  void parcheck ();
+  void parallel ();
+
+  CellPool cells;       //!< allocator for all Cell objects
+  std::vector<Cell*> tmpcells; //!< released temporary cells ready for reuse
+  int engine;           //!< AWK_ENGINE_TREE or AWK_ENGINE_VM
+  int nworkers;         //!< threads running the main rules (1 = no parallel run)
+  bool readahead;       //!< read input files in a background thread
+  size_t mapwin;        //!< mapping window for input files (0 = no mapping)
+  std::vector<Cell*> paradd; //!< variables the main rules only add to
+  std::unique_ptr<Code> code[3]; //!< bytecode for BEGIN, main rules and END
   int status;           //!< Interpreter status. See below
 #define AWKS_INIT       1   //!< status block initialized
 #define AWKS_COMPILING  2   //!< compilation started
@@ -285,7 +563,11 @@ public:
   bool first_run;       //!< true on first run after compile
   int lineno;           //!< line number in awk program
   Array *symtab;        //!< symbol table
+  Cell* literal0;       //!< constant 0
+  Cell* literal_null;   //!< constant empty string and 0
   Node *prog_root;      //!< root of parsing tree
+  Program* program;     //!< shared program this interpreter was made from
+  std::vector<int> pairstack; //!< state of each pat,pat pattern
   int argno;            //!< current input argument number */
   Array *envir;         //!< environment variables
   Array* argvtab;       //!< ARGV[n] array
@@ -302,13 +584,37 @@ public:
                                //!< 2 = stderr
   int nfiles;           //!< number of entries in files table
   FILE* infile;         //!< current input file
+  FILE* nextin;         //!< next input file, opened ahead of time
+  std::string nextname; //!< name of `nextin`
   inproc inredir;       //!< input redirection function
+  std::map<FILE*, std::unique_ptr<InputStream>> instreams; //!< input buffers
+  std::string recbuf;   //!< scratch buffer for reading records
   outproc outredir;     //!< output redirection function
   struct Frame  fn;     //!< frame data for current function call
+  std::vector<Slot> callstack; //!< argument slots of active function calls
+  size_t sp;            //!< first free slot in call stack
+  std::vector<awksymb> extargs; //!< arguments of external function
   bool donerec;         //!< true if record is valid (no fld has changed)
-  bool donefld;         //!< true if record broken into fields
+  bool donefld;         //!< true if record broken into fields (maybe only up to nsplit)
+  bool donenf;          //!< true if NF is valid
+  int nsplit;           //!< number of fields split so far
+  int maxsplit;         //!< fields after this one are known to be empty
+  int maxfld;           //!< highest constant field number used in program
+  unsigned long recgen; //!< incremented every time $0 changes
+  std::unique_ptr<Dfa> patdfa; //!< combined regex of /re/ patterns
+  std::vector<char> patfound; //!< /re/ patterns matching current record
+  unsigned long patgen; //!< value of `recgen` when `patfound` was computed
+  std::unordered_map<const Cell*, Repl> repltab; //!< parsed constant replacements
+  Repl repl;            //!< parsed replacement for non-constant strings
+  std::string subbuf;   //!< result buffer for sub and gsub
+  std::string outbuf;   //!< print statements being assembled
   std::vector< std::unique_ptr<Cell> > fldtab;   //!< $0, $1, ...
-  std::vector< std::unique_ptr<Cell> > ratab;    //!< cache of last few regex
+  std::unordered_map<std::string, std::unique_ptr<Cell>> retab; //!< constant regex
+  std::list<std::unique_ptr<Cell>> ralru; //!< dynamic regex, most recently used first
+  std::unordered_map<std::string, std::list<std::unique_ptr<Cell>>::iterator> ratab; //!< index of `ralru`
+  size_t racap;         //!< capacity of dynamic regex cache
+  unsigned long rahits; //!< dynamic regex cache hits
+  unsigned long ramisses; //!< dynamic regex cache misses
 
 #define CELL_FS         predefs[0]
 #define CELL_RS         predefs[1]
@@ -329,12 +635,37 @@ public:
   Cell* predefs[NPREDEF];  //!< Predefined variables
 
 private:
-  int refldbld (const char* rec);
+  int refldbld (const char* rec, size_t len);
+  bool nextfld (size_t& pos, size_t& off, size_t& len);
+  void setview (int n, size_t off, size_t len);
+  size_t splitpos;      //!< where field splitting continues in $0
+  char splitsep;        //!< field separator used for current record
+  SepScanner splitscan; //!< separator scanner for current record
 
   //TODO remove next line when finished converting to OO
   void* interp; //only to highlight inconsistent use.
 };
 
+/*!
+  Compiled program shared by many interpreters.
+
+  The program keeps the interpreter that compiled it. That interpreter never
+  runs; interpreters made from the program get their own copies of its
+  symbol table and parse tree. The program goes away when it has been
+  released by its owner and by all interpreters made from it.
+*/
+class Program {
+public:
+  Program (Interpreter* ii);
+  Interpreter* instance ();
+  void release ();
+
+private:
+  ~Program ();
+  Interpreter* templ;       //!< interpreter that compiled the program
+  std::atomic<int> refs;    //!< reference count
+};
+
 #define FS        (interp->CELL_FS->sval)
 #define RS        (interp->CELL_RS->sval)
 #define OFS       (interp->CELL_OFS->sval)
@@ -365,8 +696,6 @@ private:
 #define MY_RLENGTH  (CELL_RLENGTH->fval)
 #define MY_ARGC     (CELL_ARGC->fval)
 
-//extern Interpreter *interp;
-
 struct awk_exception {
   awk_exception (Interpreter &interp, int code, const char* msg);
   Interpreter& interp;
@@ -374,7 +703,7 @@ struct awk_exception {
 };
 
 // --------------------------- Global variables ------------------------------
-extern Cell* literal_null;
+extern thread_local Interpreter* interp;  //current interpreter of this thread
 
 
 // -------------------------- Inline functions -------------------------------
@@ -394,11 +723,11 @@ bool Node::isvalue () const
 inline
 int Array::length () const
 {
-  return nelem;
+  return nelem + ndense;
 }
 
 inline
 int Array::size () const
 {
-  return sz;
+  return (int)(mask + 1);
 }
@@ -16,6 +16,11 @@ struct AWKINTERP
   void* unused;
 };
 
+struct AWKPROG
+{
+  void* unused;
+};
+
 typedef int (*inproc)();
 typedef int (*outproc)(const char *buf, size_t len);
 
@@ -51,6 +56,17 @@ int awk_redirect (AWKINTERP* pinter, int n, const char* fname);
 int awk_addfunc (AWKINTERP *pinter, const char *fname, awkfunc fn, int nargs);
 int awk_getvar (AWKINTERP *pinter, awksymb* var);
 int awk_setvar (AWKINTERP *pinter, awksymb* var);
+int awk_setrecache (AWKINTERP *pinter, int size);
+void awk_restats (AWKINTERP *pinter, unsigned long *hits, unsigned long *misses);
+int awk_setengine (AWKINTERP *pinter, int engine);
+int awk_setparallel (AWKINTERP *pinter, int nthreads);
+int awk_setreadahead (AWKINTERP *pinter, int on);
+int awk_setmmap (AWKINTERP *pinter, size_t window);
+AWKPROG* awk_program (AWKINTERP *pinter);
+AWKINTERP* awk_init_with_program (AWKPROG *pprog, const char **vars);
+void awk_program_end (AWKPROG *pprog);
+#define AWK_ENGINE_TREE   0   //walk the parse tree
+#define AWK_ENGINE_VM     1   //compile to bytecode
 
 #ifdef __cplusplus
 }
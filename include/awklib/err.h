@@ -26,3 +26,4 @@
 #define AWK_ERR_NOVAR       -16 //variable not found
 #define AWK_ERR_ARRAY       -17 //variable is an array
 #define AWK_ERR_INVTYPE     -18 //invalid variable type
+#define AWK_ERR_PARALLEL    -19 //program cannot run in parallel
@@ -28,6 +28,7 @@ void  setfname (Cell *);
 int   constnode (Node *);
 const char* strnode (Node *);
 Node* notnull (Node *);
+void  fldref (Node *);
 int   yylex (void*);
 int   yyparse (void*);
 void  yyinit (void);
@@ -53,6 +54,8 @@ Node* nullnode ();
 Node* makearr (Node *);
 Node* pa2stat (Node *, Node *, Node *);
 Node* linkum (Node *, Node *);
+void multipat (Node* rules);
+Node* optimize (Node* root);
 void  defn (Cell *, Node *, Node *);
 int   isarg (const char *);
 void  funnyvar (const Cell *, const char *);
@@ -66,6 +69,7 @@ void  WARNING (const char *, ...);
 double errcheck (double, const char *);
 int  isclvar (const char *);
 bool  is_number (const char *);
+bool  is_number (const char *s, size_t len, Awkfloat& val);
 inline
 bool is_number (const std::string& c)
 {
@@ -74,6 +78,7 @@ bool is_number (const std::string& c)
 
 void  adjbuf (char **pb, size_t *sz, size_t min, int q, char **pbp);
 void tempfree (Cell *a);
+Cell* gettemp ();
 
 Cell* program (const Node::Arguments&, int);
 Cell* call (const Node::Arguments&, int);
@@ -85,6 +90,7 @@ Cell* array (const Node::Arguments&, int);
 Cell* awkdelete (const Node::Arguments&, int);
 Cell* intest (const Node::Arguments&, int);
 Cell* matchop (const Node::Arguments&, int);
+Cell* patmatch (const Node::Arguments&, int);
 Cell* matchfun (const Node::Arguments& a, int);
 Cell* boolop (const Node::Arguments&, int);
 Cell* relop (const Node::Arguments&, int);
@@ -113,9 +119,9 @@ FILE* redirect (int, Node& );
 FILE* openfile (int, const char *);
 const char* filename (FILE *);
 Cell* closefile (const Node::Arguments&, int);
+void flush_all (void);
 Cell* sub (const Node::Arguments&, int);
 Cell* gsub (const Node::Arguments&, int);
-void requote (std::string& s);
 
 // TODO: make it member of Node
 Cell* execute (const Node* u);
@@ -124,6 +130,12 @@ Cell* execute (const std::unique_ptr<Node>& u)
 {
   return execute (u.get ());
 }
+Cell* execnode (const Node* u);
+Awkfloat arithval (int n, Awkfloat i, Awkfloat j);
+int compare (Cell* x, Cell* y);
+Cell* doassign (int n, Cell* x, Cell* y);
+Awkfloat assignval (int n, Awkfloat xf, Awkfloat yf);
+Cell* element (Cell* x, Cell* y);
 
 FILE* popen (const char *, const char *);
 int   pclose (FILE *);
@@ -1,19 +1,22 @@
 #define _CRT_SECURE_NO_WARNINGS
+#include <locale.h>
 #include <sstream>
+#include <thread>
+#include <vector>
 #include <utpp/utpp.h>
 
 #include <awklib/awk.h>
 #include <awklib/err.h>
 
 using namespace std;
-extern int cell_count;
+extern thread_local int cell_count;
 
 bool setup_test (const string& testfile);
 
 
 #ifdef NDEBUG
 // fake one for release mode
-int cell_count;
+thread_local int cell_count;
 #endif
 
 // A convenient way to debug individual tests
@@ -256,6 +259,394 @@ SUITE (Awklib_API)
     awk_exec (interp);
     CHECK_EQUAL ("2\n3\n", out.str ());
   }
+
+  // dynamic regular expressions cache
+  TEST_FIXTURE (fixt, recache)
+  {
+    unsigned long hits, misses;
+    awk_setprog (interp, "BEGIN {for (i=0; i<10; i++) if (\"x\" ~ (\"x\" i%3)) n++}");
+    awk_compile (interp);
+    CHECK_EQUAL (64, awk_setrecache (interp, 3));
+    awk_exec (interp);
+    awk_restats (interp, &hits, &misses);
+    CHECK_EQUAL (7, hits);
+    CHECK_EQUAL (3, misses);
+
+    awk_end (interp);
+    interp = awk_init (NULL);
+    awk_setprog (interp, "BEGIN {for (i=0; i<10; i++) if (\"x\" ~ (\"x\" i%3)) n++}");
+    awk_compile (interp);
+    awk_setrecache (interp, 2);
+    awk_exec (interp);
+    awk_restats (interp, &hits, &misses);
+    CHECK_EQUAL (0, hits);
+    CHECK_EQUAL (10, misses);
+  }
+
+  // regex in use is not evicted when getting the target splits fields
+  TEST_FIXTURE (fixt, recache_inuse)
+  {
+    awk_setprog (interp, R"(
+      function f(r) { $0 = "p1q2r"; return r }
+      BEGIN {
+        FS = "[0-9]"; $0 = "a"
+        if ($2 ~ f("q")) n++
+        if (match ($2, f("q"))) m++
+        sub (f("q"), "[&]", $2); print
+        gsub (f("[qr]"), "<&>", $3); print
+        print n, m
+      })");
+    awk_compile (interp);
+    awk_setrecache (interp, 1);
+    awk_outfunc (interp, strout);
+    awk_exec (interp);
+    CHECK_EQUAL ("p [q] r\np q <r>\n1 1\n", out.str ());
+  }
+
+  thread_local ostringstream tout;
+
+  //run interpreters in a thread and count the ones with wrong output
+  void mt_worker (const char* prog, const string* ref, int engine, int* errors)
+  {
+    for (int i = 0; i < 20; i++)
+    {
+      AWKINTERP* ii = awk_init (NULL);
+      awk_setengine (ii, engine);
+      awk_setprog (ii, prog);
+      awk_compile (ii);
+      tout.str ("");
+      awk_outfunc (ii, [](const char* buf, size_t sz)->int {tout.write (buf, sz); return 1; });
+      awk_infunc (ii, []()->int {return EOF; });
+      awk_exec (ii);
+      awk_end (ii);
+      if (tout.str () != *ref)
+        (*errors)++;
+    }
+  }
+
+  // several interpreters running in parallel
+  TEST (multithread)
+  {
+    const char* prog = R"(
+      function fib(n) { return n < 2 ? n : fib(n-1) + fib(n-2) }
+      BEGIN {
+        for (i = 1; i <= 3000; i++) { a[i % 7] += i; s = s (i % 3 == 0) }
+        for (k in a) t += a[k]
+        x = "abcabc"; n = gsub (/b+/, "[&]", x)
+        split ("a:b:c", parts, ":")
+        printf "%d %d %s %d %.2f %s\n", t, length (s), x, fib(15), t / 7, parts[3]
+      })";
+    const string ref = "4501500 3000 a[b]ca[b]c 610 643071.43 c\n";
+    const int nthreads = 8;
+    vector<thread> workers;
+    vector<int> errors (nthreads);
+    for (int i = 0; i < nthreads; i++)
+      workers.emplace_back (mt_worker, prog, &ref, i % 2 ? AWK_ENGINE_VM : AWK_ENGINE_TREE, &errors[i]);
+    for (auto& w : workers)
+      w.join ();
+    for (int i = 0; i < nthreads; i++)
+      CHECK_EQUAL (0, errors[i]);
+  }
+
+  // compiling doesn't change the numeric locale of the process
+  TEST (compile_locale)
+  {
+    const char* loc = setlocale (LC_NUMERIC, "C.UTF-8");
+    if (!loc)
+      return;   //locale not available
+    string name = loc;
+    AWKINTERP* ii = awk_init (NULL);
+    awk_setprog (ii, "BEGIN {x = 1.5}");
+    CHECK_EQUAL (1, awk_compile (ii));
+    awk_end (ii);
+    CHECK_EQUAL (name, string (setlocale (LC_NUMERIC, NULL)));
+    setlocale (LC_NUMERIC, "C");
+  }
+
+  thread_local int tline;
+
+  //run one interpreter made from a program with numbers 1 to 10 as input
+  string run_instance (AWKINTERP* ii)
+  {
+    tout.str ("");
+    tline = 0;
+    awk_outfunc (ii, [](const char* buf, size_t sz)->int {tout.write (buf, sz); return 1; });
+    awk_infunc (ii, []()->int {
+      static thread_local string buf;
+      if (buf.empty ())
+      {
+        if (tline == 10)
+          return EOF;
+        buf = to_string (++tline) + "\n";
+      }
+      int c = buf[0];
+      buf.erase (0, 1);
+      return c;
+    });
+    awk_exec (ii);
+    awk_end (ii);
+    return tout.str ();
+  }
+
+  void prog_worker (AWKPROG* prog, const string* ref, int* errors)
+  {
+    const char* vars[] = { "w=x", NULL };
+    for (int i = 0; i < 20; i++)
+    {
+      AWKINTERP* ii = awk_init_with_program (prog, vars);
+      if (!ii || run_instance (ii) != *ref)
+        (*errors)++;
+    }
+  }
+
+  // one program shared by interpreters in several threads
+  TEST (shared_program)
+  {
+    const char* prog = R"(
+      function sq(x) { return x*x }
+      /^[2-4]$/, /^6$/ { s += sq($1) }
+      $0 ~ "1" { ones++ }
+      END { printf "%d %d %s %s\n", s, ones, m, w })";
+    const string ref = "90 2 3 x\n";
+    const char* vars[] = { "m=3", NULL };
+
+    for (int engine : {AWK_ENGINE_TREE, AWK_ENGINE_VM})
+    {
+      AWKINTERP* ii = awk_init (vars);
+      awk_setengine (ii, engine);
+      awk_setprog (ii, prog);
+      AWKPROG* pg = awk_program (ii);
+      CHECK (pg);
+
+      const int nthreads = 4;
+      vector<thread> workers;
+      vector<int> errors (nthreads);
+      for (int i = 0; i < nthreads; i++)
+        workers.emplace_back (prog_worker, pg, &ref, &errors[i]);
+      for (auto& w : workers)
+        w.join ();
+      for (int i = 0; i < nthreads; i++)
+        CHECK_EQUAL (0, errors[i]);
+
+      //interpreter remains valid after program is released
+      ii = awk_init_with_program (pg, NULL);
+      awk_program_end (pg);
+      CHECK_EQUAL ("90 2 3 \n", run_instance (ii));
+    }
+  }
+
+  // a program that doesn't compile
+  TEST (shared_program_error)
+  {
+    AWKINTERP* ii = awk_init (NULL);
+    awk_setprog (ii, "{print $1");
+    CHECK (!awk_program (ii));
+    CHECK (awk_err (ii, NULL));
+    awk_end (ii);
+  }
+
+  //run a program on two input files with main rules in `nthreads` threads
+  string run_par (const char* prog, int nthreads, int engine)
+  {
+    AWKINTERP* ii = awk_init (NULL);
+    awk_setengine (ii, engine);
+    awk_setparallel (ii, nthreads);
+    awk_setprog (ii, prog);
+    awk_compile (ii);
+    awk_addarg (ii, "par1.txt");
+    awk_addarg (ii, "par2.txt");
+    tout.str ("");
+    awk_outfunc (ii, [](const char* buf, size_t sz)->int {tout.write (buf, sz); return 1; });
+    awk_exec (ii);
+    awk_end (ii);
+    return tout.str ();
+  }
+
+  // main rules running in parallel give the same results
+  TEST (parallel)
+  {
+    //first file is large enough to be split between workers
+    FILE* f = fopen ("par1.txt", "w");
+    for (int i = 0; i < 400000; i++)
+      fprintf (f, "k%d %d word%d\n", i % 97, i % 13, i % 5);
+    fclose (f);
+    f = fopen ("par2.txt", "w");
+    for (int i = 0; i < 10; i++)
+      fprintf (f, "k%d %d word%d\n", i, i, i);
+    fclose (f);
+
+    const char* prog = R"(
+      function w(s,  p) { return split (s, p, "") }
+      { a[$1] += $2; n++; c -= 1 }
+      /word3/ { m[$3]++; len += w($3) }
+      END {
+        for (k in a) t += a[k]
+        printf "%d %d %d %d %d %d %d %d %s %s\n", t, n, c, m["word3"], len, a["k5"], NR, FNR, FILENAME, $0
+      })";
+    for (int engine : {AWK_ENGINE_TREE, AWK_ENGINE_VM})
+    {
+      string ref = run_par (prog, 1, engine);
+      CHECK_EQUAL ("2400030 400010 -400010 80001 400005 24751 400010 10 par2.txt k9 9 word9\n", ref);
+      CHECK_EQUAL (ref, run_par (prog, 4, engine));
+
+      //input file already opened by getline in BEGIN
+      const char* getl = "BEGIN { getline } { n++ } END { print n, NR }";
+      CHECK_EQUAL ("400009 400010\n", run_par (getl, 1, engine));
+      CHECK_EQUAL ("400009 400010\n", run_par (getl, 4, engine));
+    }
+    remove ("par1.txt");
+    remove ("par2.txt");
+  }
+
+  // programs that cannot run in parallel
+  TEST (parallel_refused)
+  {
+    const char* bad[] = {
+      "{print}",
+      "{n = NR}",
+      "{getline}",
+      "{x = $1}",
+      "{a[$1] = 1}",
+      "{n++; if (n > 3) m++}",
+      "/a/,/b/ {n++}",
+      "{exit}",
+      "{delete a}",
+      "{split($0, a)}",
+      "{n += rand()}",
+      "{n += match($0, /a/)}",
+      "function f(x) {x[1]++} {f(a)}",
+      "{g($1)}"
+    };
+    for (auto prog : bad)
+    {
+      AWKINTERP* ii = awk_init (NULL);
+      awk_setparallel (ii, 4);
+      awk_setprog (ii, prog);
+      CHECK_EQUAL (0, awk_compile (ii));
+      CHECK_EQUAL (AWK_ERR_PARALLEL, awk_err (ii, NULL));
+      awk_end (ii);
+    }
+  }
+
+  //run a program on "mm.txt" with the given mapping window
+  string run_mmap (const char* prog, size_t window)
+  {
+    AWKINTERP* ii = awk_init (NULL);
+    awk_setprog (ii, prog);
+    CHECK_EQUAL (1, awk_setmmap (ii, window));
+    awk_compile (ii);
+    awk_addarg (ii, "mm.txt");
+    tout.str ("");
+    awk_outfunc (ii, [](const char* buf, size_t sz)->int {tout.write (buf, sz); return 1; });
+    CHECK (awk_exec (ii) >= 0);
+    awk_end (ii);
+    return tout.str ();
+  }
+
+  // memory-mapped input read through many small windows
+  TEST (mmap_window)
+  {
+    FILE* f = fopen ("mm.txt", "w");
+    for (int i = 0; i < 50000; i++)
+      fprintf (f, "%d %s\n", i, (i % 7) ? "short" : "a somewhat longer line");
+    fclose (f);
+
+    const char* prog = "{ n += $1; s += length ($0) } END { print NR, n, s, $0 }";
+    string ref = run_mmap (prog, 0);
+    CHECK_EQUAL ("50000 1249975000 660321 49999 short\n", ref);
+    CHECK_EQUAL (ref, run_mmap (prog, 1));      //smallest window possible
+    CHECK_EQUAL (ref, run_mmap (prog, 10000));  //records cross windows
+    remove ("mm.txt");
+  }
+
+  // input file truncated while it is being read
+  TEST (truncated_input)
+  {
+    FILE* f = fopen ("mm.txt", "w");
+    for (int i = 0; i < 200000; i++)
+      fprintf (f, "line %d\n", i);
+    fclose (f);
+
+    string out = run_mmap (R"(NR == 1 { printf "" > FILENAME; close (FILENAME) }
+      END { print (NR > 0 && NR < 200000) })", 0);
+    CHECK_EQUAL ("1\n", out);
+    remove ("mm.txt");
+  }
+
+  //run a program on some input files with or without read-ahead
+  string run_readahead (const char* prog, int on)
+  {
+    AWKINTERP* ii = awk_init (NULL);
+    awk_setprog (ii, prog);
+    CHECK_EQUAL (1, awk_setreadahead (ii, on));
+    awk_compile (ii);
+    awk_addarg (ii, "ra1.txt");
+    awk_addarg (ii, "v=1");
+    awk_addarg (ii, "ra2.txt");
+    awk_addarg (ii, "ra1.txt");
+    tout.str ("");
+    awk_outfunc (ii, [](const char* buf, size_t sz)->int {tout.write (buf, sz); return 1; });
+    awk_exec (ii);
+    awk_end (ii);
+    return tout.str ();
+  }
+
+  // input read in a background thread gives the same results
+  TEST (readahead)
+  {
+    //spans several blocks of the read-ahead ring
+    FILE* f = fopen ("ra1.txt", "w");
+    for (int i = 0; i < 100000; i++)
+      fprintf (f, "line %d of the first file\n", i);
+    fclose (f);
+    f = fopen ("ra2.txt", "w");
+    fprintf (f, "one\ntwo\n\nthree\nfour");
+    fclose (f);
+
+    const char* prog = R"(
+      FNR == 1 { getline g < "ra2.txt"; print FILENAME, NR, v, g }
+      { n += NF; s += length($0) }
+      END { print NR, n, s, $0 })";
+    string ref = run_readahead (prog, 0);
+    CHECK_EQUAL ("ra1.txt 1  one\n"
+                 "ra2.txt 100001 1 two\n"
+                 "ra1.txt 100006 1 \n"
+                 "200005 1200004 5577795 line 99999 of the first file\n", ref);
+    CHECK_EQUAL (ref, run_readahead (prog, 1));
+
+    //paragraph mode
+    string para = "BEGIN { RS = \"\" }" + string (prog);
+    CHECK_EQUAL (run_readahead (para.c_str (), 0), run_readahead (para.c_str (), 1));
+    remove ("ra1.txt");
+    remove ("ra2.txt");
+  }
+
+  // a file rewritten by the program before it is read is not read ahead
+  TEST (readahead_rewrite)
+  {
+    FILE* f = fopen ("ra_gen.txt", "w");
+    fputs ("old\n", f);
+    fclose (f);
+    f = fopen ("ra_first.txt", "w");
+    fputs ("first\n", f);
+    fclose (f);
+
+    AWKINTERP* ii = awk_init (NULL);
+    awk_setprog (ii, R"(
+      FILENAME == "ra_first.txt" { print "new" > "ra_gen.txt"; close ("ra_gen.txt") }
+      FILENAME == "ra_gen.txt" { print "gen", $0 })");
+    awk_setreadahead (ii, 1);
+    awk_compile (ii);
+    awk_addarg (ii, "ra_first.txt");
+    awk_addarg (ii, "ra_gen.txt");
+    tout.str ("");
+    awk_outfunc (ii, [](const char* buf, size_t sz)->int {tout.write (buf, sz); return 1; });
+    awk_exec (ii);
+    awk_end (ii);
+    CHECK_EQUAL ("gen new\n", tout.str ());
+    remove ("ra_gen.txt");
+    remove ("ra_first.txt");
+  }
 }
 
 //Check various error messages
@@ -335,7 +726,7 @@ SUITE (one_true_awk)
   struct awk_frame {
     awk_frame ();
     ~awk_frame ();
-    bool setup (const string& test_name);
+    bool setup (const string& test_name, int engine = AWK_ENGINE_TREE);
     string name;
     AWKINTERP* interp;
     int cells;
@@ -348,11 +739,18 @@ SUITE (one_true_awk)
 
   }
 
-  bool awk_frame::setup (const string & test_name)
+  bool awk_frame::setup (const string & test_name, int engine)
   {
     name = test_name;
     if (!setup_test ("tests/" + name + ".tst"))
       return false;
+    if (engine != AWK_ENGINE_TREE)
+    {
+      //start again with a fresh interpreter
+      awk_end (interp);
+      interp = awk_init (NULL);
+      CHECK_EQUAL (1, awk_setengine (interp, engine));
+    }
     CHECK (awk_addprogfile (interp, (name + ".awk").c_str ()));
     CHECK (awk_compile (interp));
     CHECK (awk_addarg (interp, (name + ".in").c_str ()));
@@ -366,6 +764,7 @@ SUITE (one_true_awk)
     remove ((name + ".in").c_str ());
     remove ((name + ".out").c_str ());
     remove ((name + ".ref").c_str ());
+    remove ((name + ".tmp").c_str ());  //scratch file written by the test
     awk_end (interp);
     if (cells != cell_count)
       printf ("Cell count %d\n", cell_count);
@@ -380,6 +779,11 @@ SUITE (one_true_awk)
     CHECK_FILE_EQUAL (#A ".out", #A ".ref");\
     CHECK (awk_exec (interp) >= 0);\
     CHECK_FILE_EQUAL (#A ".out", #A ".ref"); \
+    ABORT (setup (#A, AWK_ENGINE_VM));\
+    CHECK (awk_exec (interp) >= 0);\
+    CHECK_FILE_EQUAL (#A ".out", #A ".ref"); \
+    CHECK (awk_exec (interp) >= 0);\
+    CHECK_FILE_EQUAL (#A ".out", #A ".ref"); \
   }
 
   AWK_TEST (1_printall);
@@ -455,6 +859,9 @@ SUITE (one_true_awk)
     CHECK_FILE_EQUAL ("65_funackermann.out", "65_funackermann.ref");
     CHECK (awk_exec (interp) >= 0);
     CHECK_FILE_EQUAL ("65_funackermann.out", "65_funackermann.ref");
+    ABORT (setup ("65_funackermann", AWK_ENGINE_VM));
+    CHECK (awk_exec (interp) >= 0);
+    CHECK_FILE_EQUAL ("65_funackermann.out", "65_funackermann.ref");
     awk_setdebug (d);
   };
 
@@ -491,6 +898,24 @@ SUITE (one_true_awk)
   AWK_TEST (97_set);
   AWK_TEST (98_set);
   AWK_TEST (99_set);
+  AWK_TEST (100_paragraph);
+  AWK_TEST (101_getline);
+  AWK_TEST (102_fieldview);
+  AWK_TEST (103_lazyfield);
+  AWK_TEST (104_strnum);
+  AWK_TEST (105_longsplit);
+  AWK_TEST (106_refield);
+  AWK_TEST (107_regex);
+  AWK_TEST (108_literal);
+  AWK_TEST (109_multipat);
+  AWK_TEST (110_intkeys);
+  AWK_TEST (111_numvars);
+  AWK_TEST (112_fold);
+  AWK_TEST (113_frames);
+  AWK_TEST (114_output);
+  AWK_TEST (115_shrinkfld);
+  AWK_TEST (116_beginrec);
+  AWK_TEST (117_leftmost);
 }
 
 
@@ -0,0 +1,22 @@
+BEGIN { RS = "" }
+{ print NR ": " $1 " (" NF " fields)" }
+END { print "last: " $NF }
+##Input
+
+
+Alice Smith
+12 Main Street
+Springfield
+
+Bob Jones
+7 Elm Street
+
+
+
+Carol White
+##Output
+1: Alice (6 fields)
+2: Bob (5 fields)
+3: Carol (2 fields)
+last: White
+##END
@@ -0,0 +1,23 @@
+NR == 1 {
+  while ((getline line < FILENAME) > 0)
+    n++
+  close (FILENAME)
+  print "lines:", n
+}
+{ print NR, $2 }
+END {
+  print "status:", getline
+  print "last:", $0
+}
+##Input
+1 one
+2 two
+3 three
+##Output
+lines: 3
+1 one
+2 two
+3 three
+status: 0
+last: 3 three
+##END
@@ -0,0 +1,24 @@
+# fields are views into $0 until the record changes
+{
+  first = $1
+  sub (/b/, "X", $2)
+  print
+  print $2
+  $0 = $3 " " first
+  print NF ": " $1 "-" $2
+  $1 = $2
+  print
+}
+##Input
+aa bb cc
+abc bcd cde def
+##Output
+aa Xb cc
+Xb
+2: cc-aa
+aa aa
+abc Xcd cde def
+Xcd
+2: cde-abc
+abc abc
+##END
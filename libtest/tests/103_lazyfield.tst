@@ -0,0 +1,27 @@
+# fields are split only as far as needed; NF and $0 stay consistent
+{
+  print $2, NF, $NF
+  i = 3
+  print $i
+  NF = 2
+  print
+  print NF ": [" $3 "]"
+}
+##Input
+a b c d
+one two three
+x
+##Output
+b 4 d
+c
+a b
+2: []
+two 3 three
+three
+one two
+2: []
+ 1 x
+
+x 
+2: []
+##END
@@ -0,0 +1,15 @@
+# numeric strings from input compare as numbers
+{
+  x = $1
+  n = split ($0, a)
+  print ($1 < $2), (x < $2), (a[1] < a[n-1]), ($1 == $3)
+}
+##Input
+9 10 9.0
+abc abd 0
+ 2  10 2e0
+##Output
+1 1 1 1
+1 1 1 0
+1 1 1 1
+##END
@@ -0,0 +1,12 @@
+# field splitting across long records
+{
+  n = split ($0, a, ",")
+  print NF, $NF, $9, n, a[n - 1]
+}
+##Input
+alpha beta	gamma delta  epsilon zeta eta theta iota kappa lambda mu nu xi omicron pi,rho
+ 0123456789 0123456789 0123456789 0123456789 0123456789 0123456789 0123456789 x,y,,z 
+##Output
+16 pi,rho iota 2 alpha beta	gamma delta  epsilon zeta eta theta iota kappa lambda mu nu xi omicron pi
+8 x,y,,z  4 
+##END
@@ -0,0 +1,20 @@
+# regular expression field separators
+BEGIN { FS = ":+" }
+{
+  n = split ($0, a, /:+/)
+  print NF, n, $1, $NF, a[n]
+  $2 = "X"
+  print
+}
+##Input
+a::b:c
+:x::
+one
+##Output
+3 3 a c c
+a X c
+3 3   
+ X 
+1 1 one one one
+one X
+##END
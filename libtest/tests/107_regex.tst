@@ -0,0 +1,20 @@
+# regular expression engine
+{
+  print match ($0, /[[:digit:]]{2,3}/), RSTART, RLENGTH
+  s = $0; n = gsub (/x*/, "-", s); print n, s
+  s = $0; sub (/(ab|a)(c|bcd)/, "<&>", s); print s
+  if ($0 ~ /^a.*[^0-9]$/) print "anchored"
+}
+##Input
+abcd
+a1234z
+##Output
+0 0 -1
+5 -a-b-c-d-
+<abcd>
+anchored
+2 2 3
+7 -a-1-2-3-4-z-
+a1234z
+anchored
+##END
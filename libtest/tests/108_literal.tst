@@ -0,0 +1,23 @@
+# literal regular expressions
+/^GET \/api/ { print "api", NR }
+/ERROR/ { print "error", NR, match ($0, /ERROR/), RSTART, RLENGTH }
+/done$/ { print "done", NR }
+/^a\.b$/ { print "exact", NR }
+{ s = $0; n = gsub (/ab/, "<&>", s); print n, s }
+##Input
+GET /api/users
+GET /home ERROR ERROR
+a.b
+axb done
+abcab
+##Output
+api 1
+0 GET /api/users
+error 2 11 11 5
+0 GET /home ERROR ERROR
+exact 3
+0 a.b
+done 4
+0 axb done
+2 <ab>c<ab>
+##END
@@ -0,0 +1,19 @@
+# several /re/ rules, with record changes between them
+/o/ { print "o", NR }
+/^[A-Z]/ { print "cap", NR }
+/b+/ { $0 = "changed x" }
+/x/ { print "x", NR, $0 }
+$0 ~ /e$/ { print "e", NR }
+##Input
+Hello
+foo bar
+abc
+nothing
+##Output
+o 1
+cap 1
+o 2
+x 2 changed x
+x 3 changed x
+o 4
+##END
@@ -0,0 +1,21 @@
+# integer subscripts and their string forms name the same elements
+{ n = split ($0, a) }
+END {
+  for (i = 40; i > 20; i--) b[i] = i
+  b["x"] = "x"; b["07"] = "s"
+  for (i = 0; i <= 20; i++) b[i] = i
+  print n, a[2], a["3"], ("05" in a), (2.0 in a), (2 in a)
+  print length (b), b[7], b["7"], b["07"], b[30], b[70 / 2]
+  delete b[7]; delete b["8"]
+  print (7 in b), ("8" in b), length (b)
+  for (k in b) s += k
+  print s
+}
+##Input
+p q r s t
+##Output
+5 q r 0 0 1
+43 7 7 s 30 35
+0 0 41
+812
+##END
@@ -0,0 +1,24 @@
+# counters and accumulators keep their numeric values and string forms
+function bump () { calls++ }
+{ s += $1; n++; bump() }
+END {
+  print "[" u "]", s, n, calls
+  z = 0; h = 0.50; print z, h, h + 0
+  for (i = 0; i < 4; i++) t += i * 1.5
+  print i, t, t / 4
+  k = 10; k /= 4; k ^= 2; k %= 4
+  print k, k++, ++k, k--, --k
+  CONVFMT = "%.2f"; w = 1 / 3; a[w] = 1
+  for (x in a) print x, w
+}
+##Input
+1.5
+2
+3.25
+##Output
+[] 6.75 3 3
+0 0.50 0.5
+4 9 2.25
+2.25 2.25 4.25 4.25 2.25
+0.33 0.333333
+##END
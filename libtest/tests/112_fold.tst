@@ -0,0 +1,18 @@
+# constant expressions and string literals used as numbers
+function half () { return 1 / 2 }
+{ n += "2" * $1 + 2 ^ 3 - "1x" }
+END {
+  print n, 2 * 3 + 1, -(4 - 6), "a" "b" "c", length ("abc" "de")
+  print substr ("hello", 1 + 1, 3), index ("hello", "l" "o"), int (7 / 2)
+  CONVFMT = "%.2f"; x = (1 / 3) ""; print x, half() "", 10 / 4 " " 1e3
+  print (2 ^ 0.5 > 1.4), ("3" + 0 == 3), "" + 1
+}
+##Input
+1
+2
+##Output
+20 7 2 abc 5
+ell 4 3
+0.33 0.50 2.50 1e3
+1 1 1
+##END
@@ -0,0 +1,18 @@
+# argument slots are reused cleanly between calls
+function cnt(n,   a, k, c) { a[n] = 1; for (k in a) c++; return c "/" length(s) }
+function fill(arr, n) { if (n) { arr[n] = n; fill(arr, n - 1) } }
+function add(x, y) { return x + y }
+{ s = s $1 }
+END {
+  print cnt(1), cnt(2), add(add(1, 2), add(3, add(4, 5)))
+  fill(v, 3); print length(v), v[1] v[2] v[3]
+  print add(1), "[" add() "]"
+}
+##Input
+a
+b
+##Output
+1/2 1/2 15
+3 123
+1 [0]
+##END
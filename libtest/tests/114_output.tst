@@ -0,0 +1,25 @@
+# output of print statements, nested prints and redirections
+function say(s) { print "say", s; return s }
+{ print $1, say($2), $3 }
+END {
+  print "one" > "114_output.tmp"
+  printf "%s\n", "two" > "114_output.tmp"
+  while ((getline line < "114_output.tmp") > 0)
+    print "read", line
+  close ("114_output.tmp")
+  OFS = "-"; ORS = "|\n"
+  print "a", "b", say("c")
+}
+##Input
+1 2 3
+x y z
+##Output
+say 2
+1 2 3
+say y
+x y z
+read one
+read two
+say-c|
+a-b-c|
+##END
@@ -0,0 +1,32 @@
+# fields after NF are empty when records get shorter
+{ n = NF; i = 1; print $i "|"; i = NF; print $i; print $(i+1) "|"; print $(NF+1) "|" }
+NR == 3 { i = 3; print NF, $i "|" }
+##Input
+a b c d e
+  x  y  
+
+abc
+
+##Output
+a|
+e
+|
+|
+x|
+y
+|
+|
+|
+
+|
+|
+0 |
+abc|
+abc
+|
+|
+|
+
+|
+|
+##END
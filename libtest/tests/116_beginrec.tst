@@ -0,0 +1,15 @@
+# $0 assigned before any record is read
+BEGIN {
+  print NF "|" $0 "|"
+  $0 = "a b c"; print NF, $2
+  $3 = "x"; print
+}
+{ print NR, $1 }
+##Input
+first line
+##Output
+0||
+3 b
+a b x
+1 first
+##END
@@ -0,0 +1,22 @@
+# leftmost longest match after a long run of failed starts
+BEGIN { re[1] = "a*c|b"; re[2] = "(ab)*a$|x"; re[3] = "^a*b|ab*$"; re[0] = "b(a*)c|a+$" }
+{ n = match ($0, re[NR % 4]); t = $0; k = gsub (re[NR % 4], "<&>", t); print n, RSTART, RLENGTH, k, t }
+##Input
+aaaaaaaaab
+aaaaaaaaab
+aaaaaaab
+xaaaaaaaaab
+aaaaaaaacb
+ababababa
+baaaaaaab
+baaaaaaac
+##Output
+10 10 1 1 aaaaaaaaa<b>
+0 0 -1 0 aaaaaaaaab
+1 1 8 1 <aaaaaaab>
+0 0 -1 0 xaaaaaaaaab
+1 1 9 2 <aaaaaaaac><b>
+1 1 9 1 <ababababa>
+1 1 1 2 <b>aaaaaa<ab>
+1 1 9 1 <baaaaaaac>
+##END
@@ -21,6 +21,7 @@ int main (int argc, char **argv)
   int np = 0;
   int na = 0;
   char *fs = 0;
+  int engine = AWK_ENGINE_TREE;
   int ret;
 
   //parse command line
@@ -71,6 +72,8 @@ int main (int argc, char **argv)
         fprintf (stderr, version);
         exit (0);
       }
+      else if (!strcmp (argv[i] + 2, "vm"))
+        engine = AWK_ENGINE_VM;
 
     }
     else
@@ -80,6 +83,7 @@ int main (int argc, char **argv)
   awk_setdebug (1);
   // initialize interpreter
   AWKINTERP* interp = awk_init (vars);
+  awk_setengine (interp, engine);
 
   // add all programs
   for (int i = 0; i < np; i++)
@@ -5,205 +5,415 @@
 #include "awk.h"
 #include "proto.h"
 
-#define  FULLTAB  2 /* rehash when table gets this x full */
-#define  GROWTAB  4 /* grow table by this factor */
+/*
+  Arrays are open addressing hash tables with Robin Hood insertion: an
+  element being placed takes the slot of any element that is closer to its
+  home position. Probe sequences stay short, and lookups can stop as soon as
+  they reach an element closer to home than the one searched for. Each slot
+  keeps the full hash value, so names are compared only when hashes match.
+
+  Elements with small non-negative integer keys are kept in a separate
+  vector (the dense part) indexed directly by key value. A key k goes there
+  if k < dense.size(); the vector grows as long as it stays about half full.
+  Integer subscripts can reach these elements without being converted to
+  strings. A string key that is the canonical form of an integer ("12" but
+  not "012" or "12.0") finds the same element.
+*/
+
+#define  MAXLOAD  6   /* grow table when more than MAXLOAD/8 full */
+#define  MINSIZE  8   /* minimum table size */
+#define  DENSE_SLACK 16 /* dense part can have this many empty slots above 50% */
+
+
+/// 64x64 bit multiplication folded to 64 bits
+static inline uint64_t mum (uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+  uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  return lo ^ hi;
+#endif
+}
+
+/// Hash value of a string, 8 bytes at a time (in the style of wyhash)
+static uint64_t hash (const char* s, size_t len)
+{
+  const uint64_t k0 = 0xa0761d6478bd642full;
+  const uint64_t k1 = 0xe7037ed1a0b428dbull;
+  const uint64_t k2 = 0x8ebc6af09c88c6e3ull;
 
-static int  hash (const char*, int);
-extern Interpreter* interp;
+  uint64_t h = k0 ^ len, w;
+  for (; len >= 8; s += 8, len -= 8)
+  {
+    memcpy (&w, s, 8);
+    h = mum (w ^ k1, h ^ k2);
+  }
+  w = 0;
+  memcpy (&w, s, len);
+  h = mum (w ^ k1, h ^ k2);
+  return mum (h ^ k0, k1);
+}
 
-/// Make a new symbol table
+/// Check if a name is an integer in canonical form and return its value
+static bool intname (const char* s, size_t len, size_t& k)
+{
+  if (len == 0 || len > 9 || (s[0] == '0' && len > 1))
+    return false;
+  k = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    if (s[i] < '0' || s[i] > '9')
+      return false;
+    k = k * 10 + (s[i] - '0');
+  }
+  return true;
+}
+
+/// Write name of integer key k in buf. Returns name length.
+static size_t keyname (size_t k, char* buf)
+{
+  char tmp[24], *p = tmp + sizeof (tmp);
+  do
+    *--p = (char)('0' + k % 10);
+  while (k /= 10);
+  size_t len = tmp + sizeof (tmp) - p;
+  memcpy (buf, p, len);
+  buf[len] = 0;
+  return len;
+}
+
+/// Make a new symbol table with room for at least n elements
 Array::Array (int n)
   : nelem (0)
-  , sz (n)
-  , tab{ (Cell**)calloc (n, sizeof (Cell*)) }
+  , ndense (0)
 {
+  size_t sz = MINSIZE;
+  while (sz * MAXLOAD < (size_t)n * 8)
+    sz *= 2;
+  tab = (Slot*)calloc (sz, sizeof (Slot));
   if (tab == NULL)
     FATAL (AWK_ERR_NOMEM, "out of space in makearray");
+  mask = sz - 1;
 }
 
 /// Free a hash table
 Array::~Array ()
 {
-  Cell* cp, * temp;
-  int i;
-
-  for (i = 0; i < sz; i++)
-  {
-    for (cp = tab[i]; cp != NULL; cp = temp)
-    {
-      temp = cp->cnext;  /* avoids freeing then using */
-      delete cp;
-      nelem--;
-    }
-    tab[i] = 0;
-  }
-  if (nelem != 0)
-    FATAL (AWK_ERR_OTHER, "inconsistent element count freeing array");
+  for (auto p : dense)
+    delete p;
+  for (size_t i = 0; i <= mask; i++)
+    delete tab[i].cp;
   free (tab);
 }
 
-Cell* Array::setsym (const char* n, const char* s, double f, unsigned int t)
+/// Set initial value of a new element
+static void setval (Cell* p, const char* s, double f, unsigned int t)
 {
-  Cell* p;
-  assert (n != NULL);
-  if ((p = lookup (n)) == NULL)
-  {
-    p = insert_sym (n);
-    p->fval = f;
-    p->flags = t;
-    if (s)
-      p->sval = s;
-    else
-      p->sval.clear ();
+  p->fval = f;
+  p->flags = t;
+  if (s)
+    p->sval = s;
 #ifndef  NDEBUG
-    dprintf ("setsym added n=%s t=%s",p->nval.c_str() , flags2str (p->flags));
-    if ((p->flags & NUM) != 0)
-      dprintf (" f=%g", p->fval);
-    if ((p->flags & STR) != 0)
-      dprintf (" s=<%s>", quote (p->sval).c_str ());
-    dprintf ("\n");
+  dprintf ("setsym added n=%s t=%s", p->nval.c_str (), flags2str (p->flags));
+  if ((p->flags & NUM) != 0)
+    dprintf (" f=%g", p->fval);
+  if ((p->flags & STR) != 0)
+    dprintf (" s=<%s>", quote (p->sval).c_str ());
+  dprintf ("\n");
 #endif
-  }
+}
+
+/// Return element with name n. If it doesn't exist, a new one is created.
+Cell* Array::setsym (const char* n, const char* s, double f, unsigned int t)
+{
+  bool added;
+  assert (n != NULL);
+  Cell* p = get (n, strlen (n), added);
+  if (added)
+    setval (p, s, f, t);
   else
     dprintf ("setsym found n=%s t=%s\n", p->nval.c_str(), flags2str (p->flags));
   return p;
 }
 
+/// Return element with integer key k. If it doesn't exist, a new one is created.
+Cell* Array::setsym (size_t k, const char* s, double f, unsigned int t)
+{
+  bool added;
+  Cell* p = get (k, added);
+  if (added)
+    setval (p, s, f, t);
+  return p;
+}
+
 /// Add an array as element to this array.
 /// n - array name
 /// arry - element to be added
 /// addl_flags - flags OR'ed to existing ones
 Cell* Array::setsym (const char* n, Array* arry, int addl_flags)
 {
-  Cell* p;
-  if (n != NULL && (p = lookup (n)) != NULL)
-    dprintf ("setsym found %s", n);
-  else
+  bool added;
+  if (!n)
+    n = "";
+  Cell* p = get (n, strlen (n), added);
+  if (added)
   {
-    p = insert_sym (n);
     p->flags = ARR;
     p->arrval = arry;
   }
+  else
+    dprintf ("setsym found %s", n);
   p->flags |= addl_flags;
   return p;
 }
 
-Cell* Array::insert_sym (const char* n)
+/// Find element with name n or create a new one
+Cell* Array::get (const char* n, size_t len, bool& added)
+{
+  size_t k;
+  if (intname (n, len, k))
+    return get (k, added);
+
+  uint64_t h = hash (n, len);
+  size_t i = find (n, len, h);
+  added = (i == SIZE_MAX);
+  return added ? insert_sym (n, len, h) : tab[i].cp;
+}
+
+/// Find element with integer key k or create a new one
+Cell* Array::get (size_t k, bool& added)
+{
+  char name[24];
+  if (k < dense.size () || growdense (k))
+  {
+    Cell*& p = dense[k];
+    added = (p == NULL);
+    if (added)
+    {
+      keyname (k, name);
+      p = new Cell (name);
+      ndense++;
+    }
+    return p;
+  }
+
+  size_t len = keyname (k, name);
+  uint64_t h = hash (name, len);
+  size_t i = find (name, len, h);
+  added = (i == SIZE_MAX);
+  return added ? insert_sym (name, len, h) : tab[i].cp;
+}
+
+/*!
+  Try to extend the dense part to include key k.
+
+  Returns `false` if the dense part would become too sparse. Otherwise,
+  elements with keys in the new range are moved from the hash table.
+*/
+bool Array::growdense (size_t k)
 {
-  int h;
+  if (k >= 2 * (size_t)ndense + DENSE_SLACK)
+    return false;
 
-  dprintf ("Inserting symbol %s\n");
-  Cell *p = new Cell (n);
+  size_t i = dense.size ();
+  dense.resize (k + 1, NULL);
+  for (; nelem && i <= k; i++)
+  {
+    char name[24];
+    size_t len = keyname (i, name);
+    size_t j = find (name, len, hash (name, len));
+    if (j != SIZE_MAX)
+    {
+      dense[i] = tab[j].cp;
+      remove (j);
+      ndense++;
+    }
+  }
+  return true;
+}
 
-  nelem++;
-  if (nelem > FULLTAB * sz)
+/// Create a new element. Caller must make sure it doesn't exist already.
+Cell* Array::insert_sym (const char* n, size_t len, uint64_t h)
+{
+  dprintf ("Inserting symbol %s\n", n);
+  if ((size_t)(nelem + 1) * 8 > (mask + 1) * MAXLOAD)
     rehash ();
-  h = hash (n, sz);
-  p->cnext = tab[h];
-  tab[h] = p;
+
+  Cell* p = new Cell (n);
+  place (Slot{ h, p });
+  nelem++;
   return p;
 }
 
-/// Unchain an element from array
-Cell* Array::removesym (const std::string& n)
+/// Put an element in the table, moving others if needed
+void Array::place (Slot e)
 {
-  int h = hash (n.c_str(), sz);
-  Cell* p, * prev = NULL;
-  for (p = tab[h]; p != NULL; prev = p, p = p->cnext)
+  size_t i = e.hash & mask;
+  for (size_t dist = 0; ; i = (i + 1) & mask, dist++)
   {
-    if (n == p->nval)
+    if (!tab[i].cp)
     {
-      if (prev == NULL)  /* 1st one */
-        tab[h] = p->cnext;
-      else      /* middle somewhere */
-        prev->cnext = p->cnext;
-      --nelem;
-      return p;
+      tab[i] = e;
+      return;
+    }
+    size_t d = (i - tab[i].hash) & mask;  /* distance of slot i from home */
+    if (d < dist)
+    {
+      /* take the place of an element closer to home; move that one instead */
+      std::swap (e, tab[i]);
+      dist = d;
     }
   }
-  return 0;
 }
 
-/// Delete an element pointed by an iterator
-void Array::deletecell (Iterator& p)
+/// Remove element in slot i, shifting back the ones that follow
+void Array::remove (size_t i)
 {
-  if (p.owner != this || p.ipos >= sz)
-    throw awk_exception (*interp, AWK_ERR_OTHER, "Invalid iterator in delete_cell");
-
-  Cell *cp = tab[p.ipos];
-  Cell* prev = 0;
-  while (cp && cp != p.ptr)
+  size_t j = (i + 1) & mask;
+  while (tab[j].cp && ((j - tab[j].hash) & mask) != 0)
   {
-    prev = cp;
-    cp = cp->cnext;
+    tab[i] = tab[j];
+    i = j;
+    j = (j + 1) & mask;
   }
-  if (!cp)
-    throw awk_exception (*interp, AWK_ERR_OTHER, "Invalid iterator in delete_cell");
+  tab[i].cp = NULL;
+  tab[i].hash = 0;
+  nelem--;
+}
 
-  if (prev)
-    prev->cnext = cp->cnext;
-  else
-    tab[p.ipos] = cp->cnext;
+/// Unchain an element from array
+Cell* Array::removesym (const std::string& n)
+{
+  size_t k;
+  if (intname (n.c_str (), n.size (), k))
+    return removesym (k);
+
+  size_t i = find (n.c_str (), n.size (), hash (n.c_str (), n.size ()));
+  if (i == SIZE_MAX)
+    return 0;
+  Cell* p = tab[i].cp;
+  remove (i);
+  return p;
+}
 
-  //advance iterator to next valid position
-  p.ptr = cp->cnext;
-  while (p.ptr == 0 && p.ipos < sz)
+/// Unchain element with integer key k from array
+Cell* Array::removesym (size_t k)
+{
+  if (k < dense.size ())
   {
-    p.ipos++;
-    p.ptr = tab[p.ipos];
+    Cell* p = dense[k];
+    if (p)
+    {
+      dense[k] = NULL;
+      ndense--;
+    }
+    return p;
   }
 
-  delete cp;
-  --nelem;
+  char name[24];
+  size_t len = keyname (k, name);
+  size_t i = find (name, len, hash (name, len));
+  if (i == SIZE_MAX)
+    return 0;
+  Cell* p = tab[i].cp;
+  remove (i);
+  return p;
 }
 
-/// Form hash value for string s
-int hash (const char* s, int n)
+/// Delete an element pointed by an iterator
+void Array::deletecell (Iterator& p)
 {
-  unsigned hashval;
+  size_t nd = dense.size ();
+  if (p.owner != this || p.ipos > nd + mask || !p.ptr
+   || (p.ipos < nd ? dense[p.ipos] : tab[p.ipos - nd].cp) != p.ptr)
+    throw awk_exception (*interp, AWK_ERR_OTHER, "Invalid iterator in delete_cell");
+
+  delete p.ptr;
+  if (p.ipos < nd)
+  {
+    dense[p.ipos] = NULL;
+    ndense--;
+    p.next ();
+    return;
+  }
+  remove (p.ipos - nd);
 
-  for (hashval = 0; *s != '\0'; s++)
-    hashval = (*s + 31 * hashval);
-  return hashval % n;
+  //advance iterator to next valid position; it may have been shifted into this slot
+  p.ptr = tab[p.ipos - nd].cp;
+  if (!p.ptr)
+    p.next ();
 }
 
-///  Rehash items in small table into big one
+///  Double the table size
 void Array::rehash ()
 {
-  int i, nh, nsz;
-  Cell* cp, * op, ** np;
+  size_t nsz = 2 * (mask + 1);
+  Slot* np = (Slot*)calloc (nsz, sizeof (Slot));
+  if (np == NULL)
+    FATAL (AWK_ERR_NOMEM, "out of space growing array");
 
-  nsz = GROWTAB * sz;
-  np = (Cell**)calloc (nsz, sizeof (Cell*));
-  if (np == NULL)    /* can't do it, but can keep running. */
-    return;    /* someone else will run out later. */
-  for (i = 0; i < sz; i++)
+  Slot* old = tab;
+  size_t osz = mask + 1;
+  tab = np;
+  mask = nsz - 1;
+  for (size_t i = 0; i < osz; i++)
   {
-    for (cp = tab[i]; cp; cp = op)
-    {
-      op = cp->cnext;
-      nh = hash (cp->nval.c_str(), nsz);
-      cp->cnext = np[nh];
-      np[nh] = cp;
-    }
+    if (old[i].cp)
+      place (old[i]);
+  }
+  free (old);
+}
+
+/// Return slot number of element s with hash value h or SIZE_MAX if not found
+size_t Array::find (const char* s, size_t len, uint64_t h) const
+{
+  size_t i = h & mask;
+  for (size_t dist = 0; ; i = (i + 1) & mask, dist++)
+  {
+    const Slot& e = tab[i];
+    if (!e.cp || ((i - e.hash) & mask) < dist)
+      return SIZE_MAX;  /* s would have been placed here */
+    if (e.hash == h && e.cp->nval.size () == len
+     && !memcmp (e.cp->nval.data (), s, len))
+      return i;
   }
-  free (tab);
-  tab = np;
-  sz = nsz;
 }
 
 /// Look for s in tp
 Cell* Array::lookup (const char* s)
 {
-  Cell* p;
-  int h;
+  return lookup (s, strlen (s));
+}
+
+/// Look for the first `len` characters of s in tp
+Cell* Array::lookup (const char* s, size_t len)
+{
+  size_t k;
+  if (intname (s, len, k))
+    return lookup (k);
+  size_t i = find (s, len, hash (s, len));
+  return (i == SIZE_MAX) ? NULL : tab[i].cp;
+}
 
-  h = hash (s, sz);
-  std::string ss (s);
-  for (p = tab[h]; p != NULL; p = p->cnext)
-    if (ss == p->nval)
-      return p;   /* found it */
-  return NULL;    /* not found */
+/// Look for element with integer key k
+Cell* Array::lookup (size_t k)
+{
+  if (k < dense.size ())
+    return dense[k];
+  if (!nelem)
+    return NULL;
+
+  char name[24];
+  size_t len = keyname (k, name);
+  size_t i = find (name, len, hash (name, len));
+  return (i == SIZE_MAX) ? NULL : tab[i].cp;
 }
 
 #ifndef NDEBUG
@@ -216,18 +426,16 @@ void Array::print ()
 
 Array::Iterator Array::begin () const
 {
-  Iterator it(this);
-  while (it.ipos < sz && tab[it.ipos] == 0)
-    it.ipos++;
-  if (it.ipos < sz)
-    it.ptr = tab[it.ipos];
+  Iterator it (this);
+  it.ipos = SIZE_MAX;
+  it.next ();
   return it;
 }
 
 Array::Iterator Array::end () const
 {
   Iterator it (this);
-  it.ipos = sz;
+  it.ipos = dense.size () + mask + 1;
   return it;
 }
 
@@ -239,39 +447,30 @@ Array::Iterator::Iterator (const Array* a)
 {
 }
 
+/// Move to next element: dense part first, then hash table slots
+void Array::Iterator::next ()
+{
+  size_t nd = owner->dense.size ();
+  size_t last = nd + owner->mask;
+  ptr = 0;
+  while (!ptr && ++ipos <= last)
+    ptr = (ipos < nd) ? owner->dense[ipos] : owner->tab[ipos - nd].cp;
+  if (!ptr)
+    ipos = last + 1;
+}
 
 /// Post-increment operator 
 Array::Iterator Array::Iterator::operator++ (int)
 {
   Iterator me = *this;
-  if (ptr)
-    ptr = ptr->cnext;
-  if (!ptr)
-  {
-    while (++ipos < owner->sz && owner->tab[ipos] == 0)
-      ;
-    if (ipos < owner->sz)
-      ptr = owner->tab[ipos];
-    else
-      ptr = 0;
-  }
+  next ();
   return me;
 }
 
 /// Pre-increment operator 
 Array::Iterator& Array::Iterator::operator++ ()
 {
-  if (ptr)
-    ptr = ptr->cnext;
-  if (!ptr)
-  {
-    while (++ipos < owner->sz && owner->tab[ipos] == 0)
-      ;
-    if (ipos < owner->sz)
-      ptr = owner->tab[ipos];
-    else
-      ptr = 0;
-  }
+  next ();
   return *this;
 }
 
@@ -288,4 +487,3 @@ bool Array::Iterator::operator==(const Iterator& other) const
 {
   return (owner == other.owner) && (ipos == other.ipos) && (ptr == other.ptr);
 }
-
@@ -26,6 +26,7 @@ THIS SOFTWARE.
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include "awk.h"
 #include "proto.h"
 #define YY_NO_LEAKS
@@ -36,7 +37,6 @@ void checkdup(Node *list, Cell *item);
 void yyinit (void);
 void yyend (void);
 int  yylex (void *ii);
-extern Interpreter *interp;
 
 Node    *beginloc;
 Node    *endloc;
@@ -108,8 +108,10 @@ size_t  lexbuf_sz;      /* size of lex buffer */
 
 program:
       pas
-        { if (interp->err==0)
+        { if (interp->err==0) {
+            multipat($1);
             winner = (Node *)stat3(PROGRAM, program, beginloc, $1, endloc);
+          }
           yyend (); }
     | error
         { yyclearin; SYNTAX("bailing out"); }
@@ -323,7 +325,7 @@ rbrace:
 
 re:
        reg_expr
-        { $$ = op3(MATCH, matchfun, rectonode(), nodedfa($1), NIL); }
+        { $$ = op3(MATCH, matchop, rectonode(), nodedfa($1), NIL, MATCH); }
     | NOT re
         { $$ = op2(NOT, boolop, notnull($2), NIL, NOT); }
     ;
@@ -515,7 +517,7 @@ var:
     | IVAR
         { $$ = op1(INDIRECT, indirect, celltonode($1)); }
     | INDIRECT term
-        { $$ = op1(INDIRECT, indirect, $2); }
+        { $$ = op1(INDIRECT, indirect, $2); fldref($2); }
     ;    
 
 varlist:
@@ -533,7 +535,7 @@ varname:
     | ARG
         { $$ = op1(ARG, arg, nullnode(), $1); }
     | VARNF
-        { $$ = op1(VARNF, getnf, celltonode($1)); }
+        { $$ = op1(VARNF, getnf, celltonode($1, Cell::type::CNF)); }
     ;
 
 while:
@@ -557,6 +559,16 @@ int constnode(Node *p)
   return p->isvalue() && (p->to_cell()->flags & CONST) != 0;
 }
 
+/// Keep track of highest constant field number used by program
+void fldref(Node *p)
+{
+  if (constnode(p)) {
+    Awkfloat f = p->to_cell()->getfval();
+    if (f > interp->maxfld)
+      interp->maxfld = (f < (Awkfloat)INT_MAX) ? (int)f : INT_MAX;
+  }
+}
+
 const char *strnode(Node *p)
 {
   return p->to_cell()->sval.c_str();
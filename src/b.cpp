@@ -23,16 +23,66 @@ THIS SOFTWARE.
 ****************************************************************/
 
 #include <assert.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
 #include "awk.h"
 #include "ytab.h"
 #include "proto.h"
 
 #include <awklib/err.h>
 
-extern Interpreter* interp;
 using namespace std;
 
-int hexdigit (char c)
+/*
+  Regular expressions
+
+  Expressions are parsed into a syntax tree whose leaves are the positions
+  of an automaton. Following Aho, Sethi and Ullman, DFA states are sets of
+  positions and are built lazily, only for the transitions that are actually
+  taken, as in the original One True AWK.
+
+  Anchors are treated as zero-width symbols: BOT (beginning of text) is fed
+  before the first character and EOT (end of text) after the last one.
+  For unanchored searches the expression is preceded by an implicit `.*`.
+*/
+
+/* node types */
+#define N_LEAF    0
+#define N_EMPTY   1
+#define N_CAT     2
+#define N_OR      3
+#define N_STAR    4
+#define N_PLUS    5
+#define N_QUEST   6
+
+/* position types */
+#define P_CHAR    0   /* character from a set */
+#define P_BOT     1   /* ^ */
+#define P_EOT     2   /* $ */
+#define P_ALL     3   /* any character in the implicit .* prefix */
+#define P_FINAL   4   /* end marker */
+
+/* input symbols besides characters 0-255 */
+#define BOT       256
+#define EOT       257
+#define NSYM      258
+
+#define MAXSTATES 2000  /* flush DFA cache beyond this many states */
+#define DUP_MAX   255   /* maximum repetition count in intervals */
+
+/* where the required literal occurs (Dfa::litflags) */
+#define L_PREFIX  0x01  /* expression starts with the literal */
+#define L_PURE    0x02  /* expression is only the literal */
+#define L_BOL     0x04  /* literal is preceded by ^ */
+#define L_EOL     0x08  /* literal is followed by $ */
+
+/* results of Dfa::prefilter */
+#define PF_FAIL   0     /* string cannot match */
+#define PF_MATCH  1     /* literal expression found */
+#define PF_DFA    2     /* automaton must decide */
+
+static int hexdigit (int c)
 {
   if (isdigit (c))
     return c - '0';
@@ -43,34 +93,865 @@ int hexdigit (char c)
   else
     return 0;
 }
-/*
-  There is no flavor of std::regex that exactly matches GAWK (or One True AWK)
-  syntax. The std::regex::constants::awk does not accept hex escaping (\xhh)
-  and std::regex::constants::ECMAScript does not accept octal escaping (\ddd).
 
-  Here we convert a string containing \xhh to \ddd. The number of characters
-  remains the same.
+/// Compile a regular expression
+Dfa::Dfa (const char* re)
+  : src (re)
+  , rp (src.c_str ())
+  , maxstates (MAXSTATES)
+{
+  root = regexp ();
+  if (*rp)
+    error ("unmatched )");
+  literal (root);
+  build (node (N_CAT, root, endmark ()));
+}
+
+/*!
+  Compile several regular expressions into one automaton.
+
+  The automaton is used only by matchall() to find which expressions
+  match a string; each expression gets its own end marker.
+*/
+Dfa::Dfa (const vector<string>& res)
+  : rp (nullptr)
+  , root (-1)
+  , litflags (0)
+  , maxstates (MAXSTATES + 20 * res.size ())
+{
+  int ar = -1;
+  for (auto& re : res)
+  {
+    src = re;
+    rp = src.c_str ();
+    int r = regexp ();
+    if (*rp)
+      error ("unmatched )");
+    r = node (N_CAT, r, endmark ());
+    ar = (ar < 0) ? r : node (N_OR, ar, r);
+  }
+  build (ar < 0 ? node (N_CAT, node (N_EMPTY), endmark ()) : ar);
+}
+
+/*!
+  Build the automaton of an expression read backwards.
+
+  It is used only by leftmost() to find where matches of `fwd` start.
+  ^ and $ swap roles: BOT is fed at the end of the text and EOT at its start.
+*/
+Dfa::Dfa (const Dfa& fwd, int r)
+  : src (fwd.src)
+  , rp (nullptr)
+  , root (-1)
+  , litflags (0)
+  , maxstates (MAXSTATES)
+{
+  build (node (N_CAT, reverse (fwd, r), endmark ()));
+}
+
+/// Copy subtree `n` of `fwd` with concatenations reversed
+int Dfa::reverse (const Dfa& fwd, int n)
+{
+  ReNode t = fwd.tree[n];
+  if (t.type == N_LEAF)
+  {
+    int type = fwd.ptype[t.pos];
+    if (type == P_BOT)
+      type = P_EOT;
+    else if (type == P_EOT)
+      type = P_BOT;
+    return leaf (type, fwd.pchars[t.pos]);
+  }
+  int l = (t.left >= 0) ? reverse (fwd, t.left) : -1;
+  int r = (t.right >= 0) ? reverse (fwd, t.right) : -1;
+  return (t.type == N_CAT) ? node (N_CAT, r, l) : node (t.type, l, r);
+}
+
+/// Add an end marker leaf
+int Dfa::endmark ()
+{
+  int n = leaf (P_FINAL);
+  finals.push_back (tree[n].pos);
+  return n;
+}
+
+/// Finish compilation of anchored expression `ar`
+void Dfa::build (int ar)
+{
+  int ur = node (N_CAT, node (N_STAR, leaf (P_ALL)), ar);
+  follow (ar, ur);
+  flush ();
+}
+
+/// Report a syntax error
+void Dfa::error (const char* msg)
+{
+  FATAL (AWK_ERR_SYNTAX, "Invalid regular expression - %s - %s", src.c_str (), msg);
+}
+
+/*!
+  Find the longest literal string that every match must contain.
+
+  The expression is seen as a sequence of concatenated items; runs of single
+  characters in this sequence are literals. If the whole expression is a
+  literal, possibly anchored, the automaton is not needed at all.
+*/
+void Dfa::literal (int r)
+{
+  auto litchar = [this] (int n) {
+    if (tree[n].type != N_LEAF || ptype[tree[n].pos] != P_CHAR
+     || pchars[tree[n].pos].count () != 1)
+      return -1;
+    int c = 0;
+    while (!pchars[tree[n].pos][c])
+      c++;
+    return c;
+  };
+  auto is = [this] (int n, int type) {
+    return tree[n].type == N_LEAF && ptype[tree[n].pos] == type;
+  };
+
+  /* flatten concatenations */
+  vector<int> seq, stack{ r };
+  while (!stack.empty ())
+  {
+    int n = stack.back ();
+    stack.pop_back ();
+    if (tree[n].type == N_CAT)
+    {
+      stack.push_back (tree[n].right);
+      stack.push_back (tree[n].left);
+    }
+    else
+      seq.push_back (n);
+  }
+
+  size_t first = (!seq.empty () && is (seq[0], P_BOT)) ? 1 : 0;
+  size_t start = 0;
+  string run;
+  lit.clear ();
+  litflags = 0;
+  for (size_t i = first; i <= seq.size (); i++)
+  {
+    int c = (i < seq.size ()) ? litchar (seq[i]) : -1;
+    if (c >= 0)
+      run.push_back ((char)c);
+    else
+    {
+      if (run.size () > lit.size ())
+      {
+        lit = run;
+        start = i - run.size ();
+      }
+      run.clear ();
+    }
+  }
+  if (lit.empty () || start != first)
+    return;
+
+  litflags = L_PREFIX;
+  if (first)
+    litflags |= L_BOL;
+  size_t end = first + lit.size ();
+  if (end == seq.size ())
+    litflags |= L_PURE;
+  else if (end + 1 == seq.size () && is (seq[end], P_EOT))
+    litflags |= L_PURE | L_EOL;
+}
+
+/// regexp: branch { '|' branch }
+int Dfa::regexp ()
+{
+  int n = branch ();
+  while (*rp == '|')
+  {
+    rp++;
+    n = node (N_OR, n, branch ());
+  }
+  return n;
+}
+
+/// branch: { piece }
+int Dfa::branch ()
+{
+  int n = -1;
+  while (*rp && *rp != '|' && *rp != ')')
+  {
+    int p = piece ();
+    n = (n < 0) ? p : node (N_CAT, n, p);
+  }
+  return (n < 0) ? node (N_EMPTY) : n;
+}
+
+/// piece: atom { '*' | '+' | '?' | interval }
+int Dfa::piece ()
+{
+  int n = atom ();
+  for (;;)
+  {
+    if (*rp == '*')
+      n = node (N_STAR, n);
+    else if (*rp == '+')
+      n = node (N_PLUS, n);
+    else if (*rp == '?')
+      n = node (N_QUEST, n);
+    else if (*rp == '{' && interval (n))
+      continue;
+    else
+      break;
+    rp++;
+  }
+  return n;
+}
+
+/*!
+  Interval expression {n}, {n,} or {n,m}.
+
+  If the text that follows '{' is not a valid interval, returns false and
+  the brace is taken literally.
 */
-void requote (string& str)
+bool Dfa::interval (int& n)
+{
+  const char* p = rp + 1;
+  int lo = 0, hi;
+  if (!isdigit ((unsigned char)*p))
+    return false;
+  while (isdigit ((unsigned char)*p))
+    lo = min (lo * 10 + *p++ - '0', DUP_MAX + 1);
+  hi = lo;
+  if (*p == ',')
+  {
+    p++;
+    if (isdigit ((unsigned char)*p))
+    {
+      hi = 0;
+      while (isdigit ((unsigned char)*p))
+        hi = min (hi * 10 + *p++ - '0', DUP_MAX + 1);
+    }
+    else
+      hi = -1;  /* no upper limit */
+  }
+  if (*p != '}')
+    return false;
+  rp = p + 1;
+  if (lo > DUP_MAX || hi > DUP_MAX)
+    error ("repetition count too large");
+  if (hi >= 0 && hi < lo)
+    error ("invalid repetition count");
+
+  /* expand to copies of the repeated expression */
+  int r = -1, copies = 0, c;
+  for (int i = 0; i < lo; i++)
+  {
+    c = copies++ ? clone (n) : n;
+    r = (r < 0) ? c : node (N_CAT, r, c);
+  }
+  if (hi < 0)
+  {
+    c = node (N_STAR, copies++ ? clone (n) : n);
+    r = (r < 0) ? c : node (N_CAT, r, c);
+  }
+  else
+  {
+    for (int i = lo; i < hi; i++)
+    {
+      c = node (N_QUEST, copies++ ? clone (n) : n);
+      r = (r < 0) ? c : node (N_CAT, r, c);
+    }
+  }
+  n = (r < 0) ? node (N_EMPTY) : r;
+  return true;
+}
+
+/// atom: '(' regexp ')' | '.' | '^' | '$' | '[' bracket | '\' escape | character
+int Dfa::atom ()
+{
+  bitset<256> cs;
+  int n, c = (unsigned char)*rp++;
+  switch (c)
+  {
+  case '(':
+    if (*rp == ')')
+    {
+      rp++;
+      return node (N_EMPTY);
+    }
+    n = regexp ();
+    if (*rp != ')')
+      error ("missing )");
+    rp++;
+    return n;
+
+  case '.':
+    cs.set ();
+    return leaf (P_CHAR, cs);
+
+  case '^':
+    return leaf (P_BOT);
+
+  case '$':
+    return leaf (P_EOT);
+
+  case '[':
+    return bracket ();
+
+  case '\\':
+    c = escape ();
+    break;
+  }
+  cs.set (c);
+  return leaf (P_CHAR, cs);
+}
+
+/// Character after a backslash
+int Dfa::escape ()
+{
+  int c = (unsigned char)*rp;
+  if (!c)
+    return '\\';
+  rp++;
+  switch (c)
+  {
+  case 'n': return '\n';
+  case 't': return '\t';
+  case 'f': return '\f';
+  case 'r': return '\r';
+  case 'b': return '\b';
+  case 'v': return '\v';
+  case 'a': return '\a';
+  case 'x':
+    if (!isxdigit ((unsigned char)*rp))
+      return 'x';
+    c = hexdigit (*rp++);
+    if (isxdigit ((unsigned char)*rp))
+      c = (c << 4) + hexdigit (*rp++);
+    return c;
+  }
+  if (c >= '0' && c <= '7')
+  {
+    c -= '0';
+    for (int i = 0; i < 2 && *rp >= '0' && *rp <= '7'; i++)
+      c = (c << 3) + *rp++ - '0';
+    return c & 0xff;
+  }
+  return c;
+}
+
+/// Bracket expression. Opening '[' has already been seen.
+int Dfa::bracket ()
 {
-  auto s = str.begin ();
-  while (s != str.end())
+  static const struct {
+    const char* name;
+    int (*fn)(int);
+  } classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+    { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+    { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+    { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    { NULL, NULL }
+  };
+
+  bitset<256> cs;
+  bool neg = false;
+  if (*rp == '^')
   {
-    if (*s == '\\' && *(s + 1) == 'x'
-      && isxdigit (*(s + 2)) && isxdigit (*(s + 3)))
+    neg = true;
+    rp++;
+  }
+  bool first = true;
+  while (*rp && (*rp != ']' || first))
+  {
+    first = false;
+    if (*rp == '[' && rp[1] == ':')
+    {
+      const char* e = strstr (rp + 2, ":]");
+      if (e)
+      {
+        string name (rp + 2, e - rp - 2);
+        int i;
+        for (i = 0; classes[i].name && name != classes[i].name; i++)
+          ;
+        if (!classes[i].name)
+          error ("invalid character class");
+        for (int c = 1; c < 128; c++)
+          if (classes[i].fn (c))
+            cs.set (c);
+        rp = e + 2;
+        continue;
+      }
+    }
+    int c = (unsigned char)*rp++;
+    if (c == '\\')
+      c = escape ();
+    if (*rp == '-' && rp[1] && rp[1] != ']')
     {
-      int n = 0;
-      *s++ = '\\';
-      n = (hexdigit (*(s + 1)) << 4) + hexdigit (*(s + 2));
-      *s++ = (n >> 6) + '0';
-      *s++ = ((n >> 3) & 0x07) + '0';
-      *s++ = (n & 0x07) + '0';
+      rp++;
+      int d = (unsigned char)*rp++;
+      if (d == '\\')
+        d = escape ();
+      if (d < c)
+        error ("invalid range in [ ]");
+      while (c <= d)
+        cs.set (c++);
     }
     else
-      s++;
+      cs.set (c);
+  }
+  if (!*rp)
+    error ("missing ]");
+  rp++;
+  if (neg)
+    cs.flip ();
+  return leaf (P_CHAR, cs);
+}
+
+/// Add a syntax tree node
+int Dfa::node (int type, int left, int right)
+{
+  ReNode n{ type, left, right, -1 };
+  tree.push_back (n);
+  return (int)tree.size () - 1;
+}
+
+/// Add a leaf node and its position
+int Dfa::leaf (int type, const bitset<256>& cs)
+{
+  int n = node (N_LEAF);
+  tree[n].pos = (int)ptype.size ();
+  ptype.push_back (type);
+  pchars.push_back (cs);
+  return n;
+}
+
+/// Copy a subtree with new positions
+int Dfa::clone (int n)
+{
+  ReNode t = tree[n];
+  if (t.type == N_LEAF)
+    return leaf (ptype[t.pos], pchars[t.pos]);
+  int l = (t.left >= 0) ? clone (t.left) : -1;
+  int r = (t.right >= 0) ? clone (t.right) : -1;
+  return node (t.type, l, r);
+}
+
+static void merge (vector<int>& to, const vector<int>& from)
+{
+  to.insert (to.end (), from.begin (), from.end ());
+}
+
+/*!
+  Compute followpos for all positions and the initial positions of the
+  anchored and unanchored expressions.
+
+  Children are always created before their parents, so walking the tree
+  array in order is a post-order traversal.
+*/
+void Dfa::follow (int anchored, int unanchored)
+{
+  size_t nn = tree.size ();
+  vector<char> nullable (nn);
+  vector<vector<int>> first (nn), last (nn);
+  followpos.assign (ptype.size (), vector<int> ());
+
+  for (size_t i = 0; i < nn; i++)
+  {
+    const ReNode& t = tree[i];
+    int l = t.left, r = t.right;
+    switch (t.type)
+    {
+    case N_LEAF:
+      first[i].push_back (t.pos);
+      last[i].push_back (t.pos);
+      break;
+
+    case N_EMPTY:
+      nullable[i] = true;
+      break;
+
+    case N_OR:
+      nullable[i] = nullable[l] || nullable[r];
+      first[i] = first[l];
+      merge (first[i], first[r]);
+      last[i] = last[l];
+      merge (last[i], last[r]);
+      break;
+
+    case N_CAT:
+      nullable[i] = nullable[l] && nullable[r];
+      first[i] = first[l];
+      if (nullable[l])
+        merge (first[i], first[r]);
+      last[i] = last[r];
+      if (nullable[r])
+        merge (last[i], last[l]);
+      for (int p : last[l])
+        merge (followpos[p], first[r]);
+      break;
+
+    case N_STAR:
+    case N_PLUS:
+    case N_QUEST:
+      nullable[i] = (t.type != N_PLUS) || nullable[l];
+      first[i] = first[l];
+      last[i] = last[l];
+      if (t.type != N_QUEST)
+      {
+        for (int p : last[l])
+          merge (followpos[p], first[l]);
+      }
+      break;
+    }
+  }
+  for (auto& f : followpos)
+  {
+    sort (f.begin (), f.end ());
+    f.erase (unique (f.begin (), f.end ()), f.end ());
   }
+  afirst = first[anchored];
+  ufirst = first[unanchored];
+  sort (afirst.begin (), afirst.end ());
+  afirst.erase (unique (afirst.begin (), afirst.end ()), afirst.end ());
+  sort (ufirst.begin (), ufirst.end ());
+  ufirst.erase (unique (ufirst.begin (), ufirst.end ()), ufirst.end ());
 }
 
+/// Discard all DFA states and start again with only the initial ones
+void Dfa::flush ()
+{
+  states.clear ();
+  sets.clear ();
+  trans.clear ();
+  accept.clear ();
+  matched.clear ();
+  addstate (vector<int> ());  /* dead state is always 0 */
+  aini = addstate (afirst);
+  uini = addstate (ufirst);
+}
+
+/// Return number of state for a set of positions, creating it if needed
+int Dfa::addstate (const vector<int>& set)
+{
+  auto p = states.find (set);
+  if (p != states.end ())
+    return p->second;
+
+  int s = (int)sets.size ();
+  states[set] = s;
+  sets.push_back (set);
+  trans.resize (trans.size () + NSYM, -1);
+  vector<int> m;
+  for (size_t i = 0; i < finals.size (); i++)
+  {
+    if (binary_search (set.begin (), set.end (), finals[i]))
+      m.push_back ((int)i);
+  }
+  accept.push_back (!m.empty ());
+  matched.push_back (m);
+  return s;
+}
+
+/// Compute transition from state s on symbol c
+int Dfa::addtrans (int s, int c)
+{
+  vector<int> next;
+  for (int p : sets[s])
+  {
+    bool take;
+    switch (ptype[p])
+    {
+    case P_CHAR:  take = c < 256 && pchars[p][c]; break;
+    case P_ALL:   take = c < 256; break;
+    case P_BOT:   take = c == BOT; break;
+    case P_EOT:   take = c == EOT; break;
+    default:      take = false; break;
+    }
+    if (take)
+      merge (next, followpos[p]);
+    else if (c == BOT)
+      next.push_back (p);   /* BOT has no width; other positions stay */
+  }
+  sort (next.begin (), next.end ());
+  next.erase (unique (next.begin (), next.end ()), next.end ());
+
+  if (sets.size () >= maxstates)
+  {
+    /* too many states; start afresh. Old state numbers become invalid */
+    flush ();
+    return addstate (next);
+  }
+  int t = addstate (next);
+  trans[s * NSYM + c] = t;
+  return t;
+}
+
+/// Next state from state s on symbol c
+inline int Dfa::step (int s, int c)
+{
+  int t = trans[s * NSYM + c];
+  return (t >= 0) ? t : addtrans (s, c);
+}
+
+/// Find first occurrence of the required literal at or after `pos`
+bool Dfa::findlit (const char* s, size_t len, size_t& pos)
+{
+  size_t n = lit.size ();
+  if (len < n || pos > len - n)
+    return false;
+#ifdef __GLIBC__
+  const char* p = (const char*)memmem (s + pos, len - pos, lit.data (), n);
+  if (!p)
+    return false;
+  pos = p - s;
+  return true;
+#else
+  const char* p = s + pos;
+  const char* last = s + len - n;
+  while (p <= last)
+  {
+    p = (const char*)memchr (p, lit[0], last - p + 1);
+    if (!p)
+      return false;
+    if (!memcmp (p + 1, lit.data () + 1, n - 1))
+    {
+      pos = p - s;
+      return true;
+    }
+    p++;
+  }
+  return false;
+#endif
+}
+
+/*!
+  Check the required literal before running the automaton.
+
+  \param s      string to search
+  \param len    string length
+  \param notbol `true` if ^ cannot match
+  \param pos    position of literal match (PF_MATCH) or position before
+                which no match can start (PF_DFA)
+  \return       one of PF_FAIL, PF_MATCH or PF_DFA
+*/
+int Dfa::prefilter (const char* s, size_t len, bool notbol, size_t& pos)
+{
+  pos = 0;
+  if (lit.empty ())
+    return PF_DFA;
+
+  size_t n = lit.size ();
+  if (litflags & L_BOL)
+  {
+    if (notbol || len < n || memcmp (s, lit.data (), n))
+      return PF_FAIL;
+    if (!(litflags & L_PURE))
+      return PF_DFA;
+    return ((litflags & L_EOL) && len != n) ? PF_FAIL : PF_MATCH;
+  }
+  if (litflags & L_EOL)
+  {
+    if (len < n || memcmp (s + len - n, lit.data (), n))
+      return PF_FAIL;
+    pos = len - n;
+    return PF_MATCH;
+  }
+  if (!findlit (s, len, pos))
+    return PF_FAIL;
+  if (litflags & L_PURE)
+    return PF_MATCH;
+  if (!(litflags & L_PREFIX))
+    pos = 0;
+  return PF_DFA;
+}
+
+/// Return true if expression matches anywhere in string
+bool Dfa::match (const char* s, size_t len)
+{
+  size_t pos;
+  switch (prefilter (s, len, false, pos))
+  {
+  case PF_FAIL:   return false;
+  case PF_MATCH:  return true;
+  }
+  const unsigned char* p = (const unsigned char*)s + pos;
+  const unsigned char* end = (const unsigned char*)s + len;
+  int st = pos ? uini : step (uini, BOT);
+  if (accept[st])
+    return true;
+  while (p < end)
+  {
+    st = step (st, *p++);
+    if (accept[st])
+      return true;
+  }
+  return accept[step (st, EOT)] != 0;
+}
+
+/*!
+  Find which expressions match somewhere in a string.
+
+  \param s      string to search
+  \param len    string length
+  \param found  set to 1 for each expression that matches, 0 otherwise
+*/
+void Dfa::matchall (const char* s, size_t len, vector<char>& found)
+{
+  size_t left = finals.size ();
+  found.assign (left, 0);
+  auto mark = [&] (int st) {
+    for (int i : matched[st])
+    {
+      if (!found[i])
+      {
+        found[i] = 1;
+        left--;
+      }
+    }
+  };
+
+  const unsigned char* p = (const unsigned char*)s;
+  const unsigned char* end = p + len;
+  int st = step (uini, BOT);
+  if (accept[st])
+    mark (st);
+  while (p < end && left)
+  {
+    st = step (st, *p++);
+    if (accept[st])
+      mark (st);
+  }
+  if (left)
+  {
+    st = step (st, EOT);
+    if (accept[st])
+      mark (st);
+  }
+}
+
+/// Find end of longest match that starts at position p; add characters read to `steps`
+bool Dfa::longest (const char* s, size_t len, size_t p, bool bol, size_t& end, size_t& steps)
+{
+  int st = bol ? step (aini, BOT) : aini;
+  bool found = false;
+  if (accept[st])
+  {
+    found = true;
+    end = p;
+  }
+  for (size_t i = p; i < len; i++)
+  {
+    steps++;
+    st = step (st, (unsigned char)s[i]);
+    if (!st)
+      return found;
+    if (accept[st])
+    {
+      found = true;
+      end = i + 1;
+    }
+  }
+  if (accept[step (st, EOT)])
+  {
+    found = true;
+    end = len;
+  }
+  return found;
+}
+
+/*!
+  Find leftmost position where a match of the forward expression starts.
+  Called on the reversed automaton; reads the string once, from its end.
+*/
+bool Dfa::leftmost (const char* s, size_t len, bool bol, size_t& start)
+{
+  int st = step (uini, BOT);
+  bool found = false;
+  for (size_t i = len; ; i--)
+  {
+    if (accept[st])
+    {
+      found = true;
+      start = i;
+    }
+    if (!i)
+      break;
+    st = step (st, (unsigned char)s[i - 1]);
+  }
+  if (bol && accept[step (st, EOT)])
+  {
+    found = true;
+    start = 0;
+  }
+  return found;
+}
+
+/*!
+  Find leftmost longest match.
+
+  Matches are tried from each position up to the end of the earliest one.
+  That is usually cheap, but it can read the string again for every start
+  (`a*b` on a long run of `a`s). When the characters read exceed the string
+  length, the reversed automaton finds the leftmost start in a single pass,
+  so each call stays linear in the string length.
+
+  \param s      string to search
+  \param len    string length
+  \param start  match start
+  \param mlen   match length
+  \param notbol `true` if string doesn't start at the beginning of text
+                (^ cannot match)
+  \return       `true` if a match was found
+*/
+bool Dfa::pmatch (const char* s, size_t len, size_t& start, size_t& mlen, bool notbol)
+{
+  size_t pos;
+  switch (prefilter (s, len, notbol, pos))
+  {
+  case PF_FAIL:
+    return false;
+  case PF_MATCH:
+    start = pos;
+    mlen = lit.size ();
+    return true;
+  }
+  if (pos)
+  {
+    /* no match can start before the literal prefix */
+    if (!pmatch (s + pos, len - pos, start, mlen, true))
+      return false;
+    start += pos;
+    return true;
+  }
+
+  /* find where the earliest match ends; the leftmost one cannot start later */
+  int st = notbol ? uini : step (uini, BOT);
+  size_t e = 0;
+  bool found = accept[st] != 0;
+  while (!found && e < len)
+  {
+    st = step (st, (unsigned char)s[e++]);
+    found = accept[st] != 0;
+  }
+  if (!found && !accept[step (st, EOT)])
+    return false;
+
+  size_t end, steps = 0;
+  for (size_t p = 0; p <= e && steps <= len; p++)
+  {
+    if (longest (s, len, p, p == 0 && !notbol, end, steps))
+    {
+      start = p;
+      mlen = end - p;
+      return true;
+    }
+  }
+  if (!rev)
+    rev.reset (new Dfa (*this, root));
+  if (!rev->leftmost (s, len, !notbol, start)
+   || !longest (s, len, start, start == 0 && !notbol, end, steps))
+    return false;
+  mlen = end - start;
+  return true;
+}
 
 /// Compile a string into a regex and return the node containing that regex
 Node* nodedfa (const char *s)
@@ -90,7 +971,6 @@ Cell* split (const Node::Arguments& a, int)
   Cell* y = execute (a[0]);  /* source string */
   char *orig_s = tostring (y->getsval ());
   char* s = orig_s;
-  bool temp_re = false;
 
   Cell* ap = execute (a[1]);  /* array name */
   if (ap->isarr ())
@@ -98,79 +978,72 @@ Cell* split (const Node::Arguments& a, int)
   ap->makearray ();
 
   string fs;
-  regex* re = 0;
-  if (!a[2])    /* fs string */
-  {
-    fs = FS;
-  }
-  else if (a[2]->ntype == NVALUE && a[2]->to_cell ()->isregex ())
+  Dfa* re = 0;
+  if (a[2] && a[2]->ntype == NVALUE && a[2]->to_cell ()->isregex ())
   { // precompiled regexp
     if (!a[2]->to_cell ()->nval.empty())
       re = a[2]->to_cell ()->re;
   }
   else
-  {  /* split(str,arr,"string") */
-    x = execute (a[2]);
-    fs = x->getsval ();
-    if (fs.size() > 1)
-    {
-      try {
-        re = new regex (fs, regex_constants::awk);
-      }
-      catch (std::exception& x) {
-        FATAL (AWK_ERR_SYNTAX, "Invalid regular expression - %s - %s", fs.c_str(), x.what());
-      }
-      temp_re = true;
+  {
+    if (!a[2])    /* fs string */
+      fs = FS;
+    else
+    {  /* split(str,arr,"string") */
+      x = execute (a[2]);
+      fs = x->getsval ();
+      tempfree (x);
     }
+    if (fs.size () > 1)
+      re = interp->makedfa (fs.c_str ())->re;
   }
 
   int n = 0;
-  char num[10], temp;
+  char temp;
   if (re)
   {
-    cmatch m;
-
-    while (regex_search (s, m, *re))
+    if (*s)
     {
+      size_t len = strlen (s), pos = 0, q = 0, st, ml;
+      while (q < len && re->pmatch (s + q, len - q, st, ml, q > 0))
+      {
+        if (!ml)
+        {
+          q += st + 1;  /* empty matches don't separate anything */
+          continue;
+        }
+        n++;
+        char* patbeg = s + q + st;
+        temp = *patbeg;
+        *patbeg = '\0';
+        ap->arrval->setsym ((size_t)n, s + pos, 0.0, STR | NCHK);
+        *patbeg = temp;
+        pos = q = q + st + ml;
+      }
+      /* last element is what follows the last separator */
       n++;
-      sprintf (num, "%d", n);
-      char* patbeg = s + m.position ();
-      temp = *patbeg;
-      *patbeg = '\0';
-      if (is_number (s))
-        ap->arrval->setsym (num, s, atof (s), STR | NUM);
-      else
-        ap->arrval->setsym (num, s, 0.0, STR);
-      *patbeg = temp;
-      s = patbeg + m.length ();
+      ap->arrval->setsym ((size_t)n, s + pos, 0.0, STR | NCHK);
     }
   }
   else
   {
     char sep = fs[0];
+    SepScanner scan;
+    size_t len = strlen (s), fb, fe;
     if (sep == ' ')
     {
-      for (n = 0; ; )
+      scan.reset (s, len, ' ', '\t', '\n');
+      for (n = 0, fe = 0; ; )
       {
-        while (*s == ' ' || *s == '\t' || *s == '\n')
-          s++;
-        if (*s == 0)
+        fb = scan.skip (fe);
+        if (fb == len)
           break;
         n++;
-        const char* t = s;
-        do
-          s++;
-        while (*s != ' ' && *s != '\t' && *s != '\n' && *s != '\0');
-        temp = *s;
-        *s = '\0';
-        sprintf (num, "%d", n);
-        if (is_number (t))
-          ap->arrval->setsym (num, t, atof (t), STR | NUM);
-        else
-          ap->arrval->setsym (num, t, 0.0, STR);
-        *s = temp;
-        if (*s != 0)
-          s++;
+        fe = scan.find (fb);
+        temp = s[fe];
+        s[fe] = '\0';
+        ap->arrval->setsym ((size_t)n, s + fb, 0.0, STR | NCHK);
+        s[fe] = temp;
       }
     }
     else if (sep == 0)
@@ -179,33 +1052,25 @@ Cell* split (const Node::Arguments& a, int)
       {
         char buf[2];
         n++;
-        sprintf (num, "%d", n);
         buf[0] = *s;
         buf[1] = 0;
         if (isdigit (buf[0]))
-          ap->arrval->setsym (num, buf, atof (buf), STR | NUM);
+          ap->arrval->setsym ((size_t)n, buf, atof (buf), STR | NUM);
         else
-          ap->arrval->setsym (num, buf, 0.0, STR);
+          ap->arrval->setsym ((size_t)n, buf, 0.0, STR);
       }
     }
-    else if (*s != 0)
+    else if (len)
     {
-      for (;;)
+      scan.reset (s, len, sep, '\n', '\n');
+      for (fb = 0; fb <= len; fb = fe + 1)
       {
         n++;
-        const char *t = s;
-        while (*s != sep && *s != '\n' && *s != '\0')
-          s++;
-        temp = *s;
-        *s = '\0';
-        sprintf (num, "%d", n);
-        if (is_number (t))
-          ap->arrval->setsym (num, t, atof (t), STR | NUM);
-        else
-          ap->arrval->setsym (num, t, 0.0, STR);
-        *s = temp;
-        if (*s++ == 0)
-          break;
+        fe = scan.find (fb);
+        temp = s[fe];
+        s[fe] = '\0';
+        ap->arrval->setsym ((size_t)n, s + fb, 0.0, STR | NCHK);
+        s[fe] = temp;
       }
     }
   }
@@ -214,34 +1079,76 @@ Cell* split (const Node::Arguments& a, int)
   tempfree (ap);
   tempfree (y);
 
-  if (temp_re)
-    delete re;
-
-  x = new Cell (nullptr, Cell::type::CTEMP, NUM, n);
+  x = gettemp ();
+  x->setfval (n);
   return x;
 }
 
 extern Cell *True, *False;
 
-/*
-  Change replacement string for sub and gsub replacing the AWK substitution
-  operator (&) with std::regex one ($&).
-*/
-void format_repl (string& s)
+/// Parse replacement string: `&` stands for the matched text, `\c` for c
+void Repl::parse (const char* s)
 {
-  string out;
-  for (auto pc = s.begin (); pc != s.end (); pc++)
+  text.clear ();
+  amp.clear ();
+  for (; *s; s++)
   {
-    if (*pc == '\\')
+    if (*s == '\\')
     {
-      if (++pc == s.end ())
+      if (!*++s)
         break;
+      text.push_back (*s);
     }
-    else if (*pc == '&')
-      out.push_back ('$');
-    out.push_back (*pc);
+    else if (*s == '&')
+      amp.push_back (text.size ());
+    else
+      text.push_back (*s);
+  }
+}
+
+/// Append replacement text for a match of `mlen` characters at `m`
+void Repl::append (string& out, const char* m, size_t mlen) const
+{
+  size_t pos = 0;
+  for (size_t a : amp)
+  {
+    out.append (text, pos, a - pos);
+    out.append (m, mlen);
+    pos = a;
   }
-  s = out;
+  out.append (text, pos, string::npos);
+}
+
+/// Parsed replacement string of sub/gsub. Constants are parsed only once.
+static const Repl& sub_repl (Cell* y)
+{
+  if (y->flags & CONST)
+  {
+    auto p = interp->repltab.find (y);
+    if (p == interp->repltab.end ())
+    {
+      p = interp->repltab.emplace (y, Repl ()).first;
+      p->second.parse (y->getsval ());
+    }
+    return p->second;
+  }
+  interp->repl.parse (y->getsval ());
+  return interp->repl;
+}
+
+/*!
+  Regular expression of sub/gsub: either precompiled (a[1]) or dynamic (`r`,
+  the value of a[0]).
+
+  Call it after the target and replacement strings have been obtained:
+  getting them can split fields with a regex FS and evict a dynamic regex
+  from the cache.
+*/
+static Dfa* sub_regex (const Node::Arguments& a, Cell* r)
+{
+  if (!a[0])  // a[1] is already-compiled regexp
+    return a[1]->to_cell ()->re;
+  return interp->makedfa (r->getsval ())->re;
 }
 
 /// substitute command
@@ -252,37 +1159,26 @@ void format_repl (string& s)
 Cell* sub (const Node::Arguments& a, int)
 {
   Cell* result = False;
-  Cell* y;
   Cell *x = execute (a[3]);  /* target string */
-  regex* re;
-  bool temp_re = false;
-  if (!a[0])  // a[1] is already-compiled regexp
-    re = a[1]->to_cell ()->re;
-  else
+  Cell* y = execute (a[2]);  /* replacement string */
+  Cell* r = a[0] ? execute (a[0]) : nullptr;  /* regexp string */
+  const char* t = x->getsval ();
+  y->getsval ();
+  Dfa* re = sub_regex (a, r);
+  size_t tlen = strlen (t), start, len;
+  if (re->pmatch (t, tlen, start, len))
   {
-    y = execute (a[0]);
-    try {
-      re = new regex (y->sval, regex_constants::awk);
-    }
-    catch (std::exception& x) {
-      FATAL (AWK_ERR_SYNTAX, "Invalid regular expression - %s - %s", y->sval.c_str(), x.what());
-    }
-    temp_re = true;
-    tempfree (y);
-  }
-  y = execute (a[2]);  /* replacement string */
-  string repl (y->sval);
-  string target (x->getsval ());
-  format_repl (repl);
-  smatch m;
-  if (regex_search (target, m, *re))
-  {
-    target = regex_replace (target, *re, repl, regex_constants::format_first_only);
-    x->setsval (target.c_str ());
+    string& out = interp->subbuf;
+    out.assign (t, start);
+    sub_repl (y).append (out, t + start, len);
+    out.append (t + start + len, tlen - start - len);
+    x->setsval (out.c_str ());
     result = True;
   }
   tempfree (x);
   tempfree (y);
+  if (r)
+    tempfree (r);
   return result;
 }
 
@@ -295,43 +1191,63 @@ Cell* gsub (const Node::Arguments& a, int)
 {
   int num = 0;
 
-  Cell* y;
   Cell* x = execute (a[3]);  /* target string */
-  regex* re;
-  bool temp_re = false;
-  if (!a[0])  // a[1] is already-compiled regexp
-    re = a[1]->to_cell ()->re;
-  else
+  Cell* y = execute (a[2]);  /* replacement string */
+  Cell* r = a[0] ? execute (a[0]) : nullptr;  /* regexp string */
+  const char* t = x->getsval ();
+  y->getsval ();
+  Dfa* re = sub_regex (a, r);
+  size_t tlen = strlen (t), pos = 0, start, len;
+  bool after = false;   /* previous match was not empty and ended at pos */
+  const Repl* repl = nullptr;
+  string& result = interp->subbuf;
+  while (pos <= tlen && re->pmatch (t + pos, tlen - pos, start, len, pos > 0))
   {
-    y = execute (a[0]);
-    try {
-      re = new regex (y->sval, regex_constants::awk);
+    size_t mb = pos + start;
+    if (!len && after && mb == pos)
+    {
+      /* no empty match right after a previous match */
+      if (pos == tlen)
+        break;
+      result.push_back (t[pos++]);
+      after = false;
+      continue;
     }
-    catch (std::exception& x) {
-      FATAL (AWK_ERR_SYNTAX, "Invalid regular expression - %s - %s", y->sval.c_str(), x.what());
+    if (!num++)
+    {
+      /* first match; start building the result */
+      repl = &sub_repl (y);
+      result.assign (t, mb);
     }
-    temp_re = true;
-    tempfree (y);
-  }
-  y = execute (a[2]);  /* replacement string */
-  string repl (y->sval);
-  string target (x->getsval ());
-  format_repl (repl);
-  smatch m;
-  string::const_iterator i = target.begin ();
-  string result;
-  while (regex_search (i, target.cend (), m, *re))
-  {
-    result += m.prefix ();
-    result += m.format (repl);
-    i += m.position () + m.length();
-    num++;
-  }
-  result.append (i, target.cend ());
-  x->setsval (result.c_str ());
+    else
+      result.append (t + pos, start);
+    repl->append (result, t + mb, len);
+    if (len)
+    {
+      pos = mb + len;
+      after = true;
+    }
+    else
+    {
+      /* empty match; copy next character and continue after it */
+      if (mb < tlen)
+        result.push_back (t[mb]);
+      pos = mb + 1;
+      after = false;
+    }
+  }
+  if (num)
+  {
+    if (pos < tlen)
+      result.append (t + pos, tlen - pos);
+    x->setsval (result.c_str ());
+  }
   tempfree (x);
   tempfree (y);
+  if (r)
+    tempfree (r);
 
-  x = new Cell (nullptr, Cell::type::CTEMP, NUM, num);
+  x = gettemp ();
+  x->setfval (num);
   return x;
 }
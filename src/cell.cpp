@@ -1,26 +1,25 @@
 #include "awk.h"
 #include "proto.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <awklib/err.h>
 
 using namespace std;
 
-extern Interpreter* interp;
 
 #ifndef NDEBUG
-int cell_count = 0;
-std::vector<Cell*> all_cells;
+thread_local int cell_count = 0;
+thread_local std::vector<Cell*> all_cells;
 #endif
 
 
-Cell::Cell (const char* n, type t, unsigned char flags, Awkfloat f)
+Cell::Cell (const char* n, type t, unsigned short flags, Awkfloat f)
   : ctype{ t }
   , nval{ n? n : string() }
   , flags{ flags }
   , funptr{ nullptr }
   , fval{ f }
-  , fmt{ 0 }
-  , cnext{ 0 }
 {
 #ifndef NDEBUG
   dprintf ("Allocated cells = %d\n", id = ++cell_count);
@@ -53,24 +52,132 @@ Cell::~Cell ()
     dprintf ("regex\n");
     delete re;
   }
+  else if (ctype == type::CFUNC)
+    delete nodeptr;   /* function body */
 #ifndef NDEBUG
   dprintf ("Remaining cells = %d\n", --cell_count);
 #endif
 }
 
+/// Allocate a cell from the pool of current interpreter
+void* Cell::operator new (size_t sz)
+{
+  return CellPool::alloc (interp ? &interp->cells : NULL, sz);
+}
+
+/// Return a cell to the pool it came from
+void Cell::operator delete (void* p)
+{
+  CellPool::release (p);
+}
+
+#define SLAB_CELLS 512  /* number of cells in a slab */
+
+/* every block starts with a pointer to its slab (NULL if not in a slab) */
+static const size_t BLK_HDR = (sizeof (void*) + alignof (Cell) - 1) / alignof (Cell) * alignof (Cell);
+static const size_t BLK_SIZE = BLK_HDR + (sizeof (Cell) + alignof (Cell) - 1) / alignof (Cell) * alignof (Cell);
+
+CellPool::CellPool ()
+  : slabs{ NULL }
+  , free_list{ NULL }
+{
+}
+
+CellPool::~CellPool ()
+{
+  while (slabs)
+  {
+    Slab* s = slabs;
+    slabs = s->next;
+    if (s->live)
+      s->owner = NULL;  /* freed when its last cell is released */
+    else
+      free (s);
+  }
+}
+
+/// Add a new slab to the free list
+void CellPool::grow ()
+{
+  size_t first = (sizeof (Slab) + BLK_HDR - 1) / BLK_HDR * BLK_HDR;
+  Slab* s = (Slab*)malloc (first + SLAB_CELLS * BLK_SIZE);
+  if (!s)
+    FATAL (AWK_ERR_NOMEM, "out of space for cells");
+  s->owner = this;
+  s->live = 0;
+  s->next = slabs;
+  slabs = s;
+  for (char* b = (char*)s + first + (SLAB_CELLS - 1) * BLK_SIZE; b >= (char*)s + first; b -= BLK_SIZE)
+  {
+    *(Slab**)b = s;
+    *(char**)(b + BLK_HDR) = free_list;
+    free_list = b;
+  }
+}
+
+/*!
+  Allocate memory for a cell.
+
+  \param pool  pool to allocate from. If NULL, memory comes from the heap.
+  \param sz    object size
+*/
+void* CellPool::alloc (CellPool* pool, size_t sz)
+{
+  char* b;
+  if (!pool || sz + BLK_HDR > BLK_SIZE)
+  {
+    b = (char*)::operator new (sz + BLK_HDR);
+    *(Slab**)b = NULL;
+    return b + BLK_HDR;
+  }
+  if (!pool->free_list)
+    pool->grow ();
+  b = pool->free_list;
+  pool->free_list = *(char**)(b + BLK_HDR);
+  (*(Slab**)b)->live++;
+  return b + BLK_HDR;
+}
+
+/// Release memory of a cell
+void CellPool::release (void* p)
+{
+  if (!p)
+    return;
+  char* b = (char*)p - BLK_HDR;
+  Slab* s = *(Slab**)b;
+  if (!s)
+  {
+    ::operator delete (b);
+    return;
+  }
+  s->live--;
+  if (s->owner)
+  {
+    *(char**)(b + BLK_HDR) = s->owner->free_list;
+    s->owner->free_list = b;
+  }
+  else if (!s->live)
+    free (s);
+}
+
 // Assignment operator copies the value from another cell
 Cell& Cell::operator= (const Cell& rhs)
 {
   assert (!isarr () && !isfcn ());
 
-  flags &= ~(NUM | STR);
-  sval.clear ();
+  // rhs can be a view into this cell (as in $0 = $1) so copy string first
+  if (rhs.flags & FVIEW)
+    sval.assign (interp->fldtab[0]->sval, rhs.view.off, rhs.view.len);
+  else if (rhs.flags & STR)
+    sval = rhs.sval;
+  else
+    sval.clear ();
+  flags &= ~(NUM | STR | FVIEW | NCHK);
   fval = 0;
 
   switch (rhs.flags & (STR | NUM))
   {
   case (NUM | STR):
-    sval = rhs.sval;
     fval = rhs.fval;
     flags |= NUM | STR;
     break;
@@ -79,8 +186,8 @@ Cell& Cell::operator= (const Cell& rhs)
     flags |= NUM;
     break;
   case STR:
-    sval = rhs.sval;
-    // FALL THROUGH
+    flags |= STR | (rhs.flags & NCHK);
+    break;
   case 0:
     flags |= STR;
     break;
@@ -88,6 +195,16 @@ Cell& Cell::operator= (const Cell& rhs)
   return *this;
 }
 
+/// Turn a field that is a view into $0 into an independent string
+void Cell::unview ()
+{
+  if (flags & FVIEW)
+  {
+    sval.assign (interp->fldtab[0]->sval, view.off, view.len);
+    flags &= ~FVIEW;
+  }
+}
+
 ///  Set string val of a Cell
 void Cell::setsval (const char* s)
 {
@@ -100,7 +217,8 @@ void Cell::setsval (const char* s)
     funnyvar (this, "assign to");
   if (isfld())
   {
-    interp->donefld = false;  /* mark $1... invalid */
+    interp->fldbld ();        /* all fields are needed to rebuild $0 */
+    interp->donerec = false;  /* mark $0 invalid */
     fldno = stoi (nval);
     if (fldno > NF)
       interp->setlastfld (fldno);
@@ -110,23 +228,19 @@ void Cell::setsval (const char* s)
   {
     interp->donefld = false;  /* mark $1... invalid */
     interp->donerec = true;
+    interp->recgen++;
   }
+  else if (isnf ())
+    interp->fldbld ();
   else if (this == interp->CELL_OFS)
   {
     if (!interp->donerec)
       interp->recbld ();
   }
-  flags &= ~(NUM | CONVC);
-  flags |= STR;
-  fmt.clear();
+  flags &= ~(NUM | CONVC | FVIEW);
+  flags |= STR | NCHK;  /* numeric value is found when needed */
   sval = s;
-  if (is_number (s))
-  {
-    fval = atof (s);
-    flags |= NUM;
-  }
-  else
-    fval = 0.;
+  fval = 0.;
 
   if (isnf())
   {
@@ -149,11 +263,11 @@ void Cell::setfval (Awkfloat f)
   if (isarr() || isfcn())
     funnyvar (this, "assign to");
   sval.clear (); /* free any previous string */
-  flags &= ~(STR | CONVC); /* mark string invalid */
-  fmt.clear ();
+  flags &= ~(STR | CONVC | FVIEW | NCHK); /* mark string invalid */
   flags |= NUM;  /* mark number ok */
   if (isfld ())
   {
+    interp->fldbld ();        /* all fields are needed to rebuild $0 */
     interp->donerec = false;  /* mark $0 invalid */
     fldno = stoi (nval);
     if (fldno > NF)
@@ -161,6 +275,7 @@ void Cell::setfval (Awkfloat f)
   }
   else if (isnf ())
   {
+    interp->fldbld ();
     interp->donerec = false;  /* mark $0 invalid */
     interp->setlastfld ((int)f);
     dprintf ("setting NF to %g\n", f);
@@ -169,13 +284,13 @@ void Cell::setfval (Awkfloat f)
   {
     interp->donefld = false;  /* mark $1... invalid */
     interp->donerec = true;
+    interp->recgen++;
   }
   fval = f;
   if (isrec () || isfld ())
   {
     //fields have always a string value
-    fmt = CONVFMT;
-    update_str_val ();
+    update_str_val (CONVFMT.c_str ());
   }
   else
     dprintf ("setfval %c%s = %g, t=%s\n", 
@@ -188,35 +303,72 @@ Awkfloat Cell::getfval ()
   if ((flags & (NUM | STR)) == 0)
     funnyvar (this, "read float value of");
 
-  if ((isfld () || isnf ()) && !interp->donefld)
+  if (isfld () && !interp->donefld)
     interp->fldbld ();
+  else if (isnf ())
+    interp->nfbld ();
   else if (isrec () && !interp->donerec)
     interp->recbld ();
 
-  if (!(flags & NUM))  /* no numeric value */
+  if (!isnum () && !(flags & NCONV))  /* no numeric value */
+  {
+    unview ();
     fval = sval.empty() ? 0. : atof (sval.c_str());  /* best guess */
+  }
 
   dprintf ("getfval %c%s = %g, t=%s\n",
     (isfld () || isrec ()) ? '$' : ' ', nval.c_str (), fval, flags2str (flags));
   return fval;
 }
 
+/*!
+  Check if cell has a numeric value.
+
+  Strings coming from input (records, fields, split elements) or from
+  string assignments are checked for a numeric value only the first
+  time this function is called.
+*/
+bool Cell::isnum ()
+{
+  if (flags & NCHK)
+  {
+    flags &= ~NCHK;
+    const char* s;
+    size_t len;
+    if (flags & FVIEW)
+    {
+      s = interp->fldtab[0]->sval.data () + view.off;
+      len = view.len;
+    }
+    else
+    {
+      s = sval.c_str ();
+      len = sval.size ();
+    }
+    if (is_number (s, len, fval))
+      flags |= NUM;
+  }
+  return (flags & NUM) != 0;
+}
+
 /// Get string value of a Cell
 const char* Cell::getsval ()
 {
   if ((flags & (NUM | STR)) == 0)
     funnyvar (this, "read string value of");
 
-  if ((isfld () || isnf ()) && !interp->donefld)
+  if (isfld () && !interp->donefld)
       interp->fldbld ();
+  else if (isnf ())
+      interp->nfbld ();
   else if (isrec () && !interp->donerec)
       interp->recbld ();
 
+  unview ();
   if ((flags & STR) == 0)
   {
     // don't have a string value but can make one
-    fmt = CONVFMT;
-    update_str_val ();
+    update_str_val (CONVFMT.c_str ());
     flags |= CONVC;
   }
 
@@ -231,15 +383,17 @@ const char* Cell::getpssval ()
   if ((flags & (NUM | STR)) == 0)
     funnyvar (this, "print string value of");
 
-  if ((isfld () || isnf()) && !interp->donefld)
+  if (isfld () && !interp->donefld)
       interp->fldbld ();
+  else if (isnf ())
+      interp->nfbld ();
   else if (isrec () && !interp->donerec)
       interp->recbld ();
 
+  unview ();
   if ((flags & STR) == 0)
   {
-    fmt = OFMT;
-    update_str_val ();
+    update_str_val (OFMT.c_str ());
     flags &= ~CONVC;
   }
 
@@ -248,20 +402,38 @@ const char* Cell::getpssval ()
   return sval.c_str();
 }
 
+/*!
+  Get string val of a Cell for print without copying.
+
+  Fields that are still views into $0 are not turned into separate strings.
+  The returned string is not null-terminated; its length is returned in `len`.
+*/
+const char* Cell::getpssval (size_t& len)
+{
+  if (isfld () && !interp->donefld)
+    interp->fldbld ();
+  if (flags & FVIEW)
+  {
+    len = view.len;
+    return interp->fldtab[0]->sval.data () + view.off;
+  }
+  const char* s = getpssval ();
+  len = sval.size ();
+  return s;
+}
+
 /// Clear cell content
 void Cell::clear ()
 {
   sval.clear ();
   flags = STR;
   fval = 0.;
-  fmt.clear ();
 }
 
 ///Turn cell into an array discarding any previous content
 void Cell::makearray (size_t sz)
 {
   sval.clear ();
-  fmt.clear ();
   fval = 0.;
   flags = ARR;
   arrval = new Array (NSYMTAB);
@@ -269,46 +441,35 @@ void Cell::makearray (size_t sz)
 
 
 /// Check if string matches regular expression of this cell
-bool Cell::match (const char* str, bool anchored)
+bool Cell::match (const char* str)
 {
   assert (isregex ());
-  regex_constants::match_flag_type flags = regex_constants::match_default;
-  if (anchored)
-    flags |= (regex_constants::match_not_bol | regex_constants::match_not_eol);
-
-  bool result = regex_search (str, *re, flags);
-  return result;
+  return re->match (str, strlen (str));
 }
 
-/// pattern match, for sub
-bool Cell::pmatch (const char* p0, size_t& start, size_t& len, bool anchored)
+/*!
+  Find leftmost longest match of the regular expression of this cell.
+
+  If `notbol` is true, the string is not at the beginning of text and
+  ^ doesn't match.
+*/
+bool Cell::pmatch (const char* p0, size_t& start, size_t& len, bool notbol)
 {
   assert (isregex ());
-  regex_constants::match_flag_type flags = regex_constants::match_default;
-  if (anchored)
-    flags |= (regex_constants::match_not_bol | regex_constants::match_not_eol);
-
-  cmatch m;
-  if (regex_search (p0, m, *re, flags))
-  {
-    start = m.position ();
-    len = m.length ();
-    return true;
-  }
-  return false;
+  return re->pmatch (p0, strlen (p0), start, len, notbol);
 }
 
 
 
 /* Don't duplicate the code for actually updating the value */
-void Cell::update_str_val ()
+void Cell::update_str_val (const char* fmt)
 {
   char s[100];
   double dtemp;
   if (modf (fval, &dtemp) == 0)  /* it's integral */
     sprintf (s, "%.30g", fval);
   else
-    sprintf (s, fmt.c_str(), fval);
+    sprintf (s, fmt, fval);
   sval = s;
 }
 
@@ -0,0 +1,461 @@
+/*!
+  \file input.cpp
+  \brief Block-buffered input streams
+
+  Records are carved out of large blocks read directly from the file
+  descriptor instead of being assembled one character at a time. On POSIX
+  systems regular files can also be memory-mapped, if the user asks for it,
+  and records are then sliced straight out of the mapping.
+
+  If read-ahead is enabled, a background thread reads the next blocks
+  while records of the current block are being processed.
+
+  (c) Mircea Neacsu 2019
+  See README file for full copyright information.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#include "awk.h"
+#include "proto.h"
+
+using namespace std;
+
+#ifndef _MSC_VER
+/*!
+  Input stream for a range of a regular file, optionally using memory
+  mappings.
+
+  Files larger than the mapping window are mapped one window at a time.
+  If the window is 0, or a mapping cannot be created, the stream reads
+  blocks instead. Note that, like any mmap reader, a file truncated while
+  a window is mapped raises SIGBUS; this is why mapping is not the default.
+  The file size is checked again before each window.
+*/
+class MappedStream : public InputStream {
+public:
+  MappedStream (FILE* f, off_t start, off_t size, size_t window);
+  ~MappedStream ();
+
+protected:
+  size_t fill () override;
+
+private:
+  void unmap ();
+  void* map;            //!< current mapping
+  size_t maplen;        //!< length of current mapping
+  off_t pos;            //!< file offset of next window
+  off_t fsize;          //!< file size
+  size_t winsize;       //!< size of mapping window (0 = no mapping)
+};
+
+MappedStream::MappedStream (FILE* f, off_t start, off_t size, size_t window)
+  : InputStream (f, nullptr, 0)
+  , map{ nullptr }
+  , maplen{ 0 }
+  , pos{ start }
+  , fsize{ size }
+  , winsize{ window }
+{
+  /* a window must cover at least one page past the alignment */
+  static const size_t pgsize = (size_t)sysconf (_SC_PAGESIZE);
+  if (winsize && winsize < 2 * pgsize)
+    winsize = 2 * pgsize;
+  if (winsize > MMAP_WINDOW)
+    winsize = MMAP_WINDOW;
+}
+
+MappedStream::~MappedStream ()
+{
+  unmap ();
+}
+
+void MappedStream::unmap ()
+{
+  if (map)
+    munmap (map, maplen);
+  map = nullptr;
+  maplen = 0;
+}
+
+/// Map next window of the file
+size_t MappedStream::fill ()
+{
+  if (buf)
+  {
+    /* mapping failed earlier; read blocks up to the end of the range */
+    size_t n = InputStream::fill ();
+    if ((off_t)n > fsize - pos)
+    {
+      n = (size_t)(fsize - pos);
+      end = ptr + n;
+      eof = true;
+    }
+    pos += n;
+    return n;
+  }
+
+  unmap ();
+  ptr = end = nullptr;
+  /* don't map past the end of a file that was truncated meanwhile */
+  struct stat st;
+  if (winsize && !fstat (fileno (fp), &st) && st.st_size < fsize)
+    fsize = st.st_size;
+  if (pos >= fsize)
+  {
+    eof = true;
+    return 0;
+  }
+
+  static const off_t pgmask = (off_t)sysconf (_SC_PAGESIZE) - 1;
+  off_t start = pos & ~pgmask;
+  size_t skip = (size_t)(pos - start);
+  size_t len = (size_t)(fsize - start) < winsize ? (size_t)(fsize - start) : winsize;
+  map = winsize ? mmap (NULL, len, PROT_READ, MAP_PRIVATE, fileno (fp), start) : MAP_FAILED;
+  if (map == MAP_FAILED)
+  {
+    /* no mapping; continue with plain reads from the same position */
+    map = nullptr;
+    buf = new char[INBUF_SIZE];
+    if (lseek (fileno (fp), pos, SEEK_SET) == (off_t)-1)
+    {
+      eof = true;
+      return 0;
+    }
+    return fill ();
+  }
+  madvise (map, len, MADV_SEQUENTIAL);
+  maplen = len;
+  ptr = (const char*)map + skip;
+  end = (const char*)map + len;
+  pos = start + len;
+  return end - ptr;
+}
+
+/*!
+  Input stream filled by a background reader thread.
+
+  The reader fills a ring of RA_BLOCKS blocks and the interpreter consumes
+  them in order. There is only one producer and one consumer so each side
+  moves its own index; the mutex is taken only to sleep when the ring is
+  full or empty. A block of length 0 marks the end of input and the reader
+  stops there. It is started again if the interpreter tries to read past
+  the end of input.
+*/
+class AsyncStream : public InputStream {
+public:
+  AsyncStream (FILE* f);
+  ~AsyncStream ();
+
+protected:
+  size_t fill () override;
+
+private:
+  void reader ();
+  void wake (const std::atomic<bool>& waiting);
+  char* blocks;                 //!< ring of RA_BLOCKS blocks
+  size_t len[RA_BLOCKS];        //!< amount of data in each block
+  std::atomic<unsigned> head;   //!< next block to consume
+  std::atomic<unsigned> tail;   //!< next block to fill
+  std::atomic<bool> rwait;      //!< reader waits for a free block
+  std::atomic<bool> cwait;      //!< consumer waits for data
+  std::atomic<bool> quit;       //!< reader should stop
+  bool held;                    //!< block at `head` is being consumed
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::thread thr;
+};
+
+/// Reader thread checks if it should quit this often when input is idle (ms)
+#define POLL_INTERVAL 20
+
+AsyncStream::AsyncStream (FILE* f)
+  : InputStream (f, nullptr, 0)
+  , blocks{ new char[RA_BLOCKS * INBUF_SIZE] }
+  , head{ 0 }
+  , tail{ 0 }
+  , rwait{ false }
+  , cwait{ false }
+  , quit{ false }
+  , held{ false }
+  , thr (&AsyncStream::reader, this)
+{
+}
+
+AsyncStream::~AsyncStream ()
+{
+  if (thr.joinable ())
+  {
+    quit = true;
+    {
+      std::lock_guard<std::mutex> lk (mtx);
+      cv.notify_all ();
+    }
+    thr.join ();
+  }
+  delete[] blocks;
+}
+
+/// Wake up the other side if it is waiting
+void AsyncStream::wake (const std::atomic<bool>& waiting)
+{
+  if (waiting)
+  {
+    std::lock_guard<std::mutex> lk (mtx);
+    cv.notify_all ();
+  }
+}
+
+/// Body of reader thread
+void AsyncStream::reader ()
+{
+  int fd = fileno (fp);
+  for (;;)
+  {
+    unsigned t = tail.load (std::memory_order_relaxed);
+    if (t - head == RA_BLOCKS)
+    {
+      std::unique_lock<std::mutex> lk (mtx);
+      rwait = true;
+      cv.wait (lk, [&] {return quit || t - head < RA_BLOCKS; });
+      rwait = false;
+    }
+
+    /* pipes and FIFOs may block indefinitely; check `quit` from time to time */
+    ssize_t ret;
+    for (;;)
+    {
+      if (quit)
+        return;
+      struct pollfd pfd = { fd, POLLIN, 0 };
+      int r = poll (&pfd, 1, POLL_INTERVAL);
+      if (r == 0 || (r < 0 && errno == EINTR))
+        continue;
+      ret = read (fd, blocks + (t % RA_BLOCKS) * INBUF_SIZE, INBUF_SIZE);
+      if (ret >= 0 || (errno != EINTR && errno != EAGAIN))
+        break;
+    }
+    len[t % RA_BLOCKS] = (ret > 0) ? ret : 0;
+    tail = t + 1;
+    wake (cwait);
+    if (ret <= 0)
+      return;
+  }
+}
+
+/// Get next block from reader thread
+size_t AsyncStream::fill ()
+{
+  ptr = end = nullptr;
+  if (held)
+  {
+    head = head + 1;  //done with this block
+    held = false;
+    wake (rwait);
+  }
+  if (eof)
+    return 0;
+  if (!thr.joinable ())
+    thr = std::thread (&AsyncStream::reader, this);
+
+  unsigned h = head.load (std::memory_order_relaxed);
+  if (tail == h)
+  {
+    std::unique_lock<std::mutex> lk (mtx);
+    cwait = true;
+    cv.wait (lk, [&] {return tail != h; });
+    cwait = false;
+  }
+  size_t n = len[h % RA_BLOCKS];
+  if (!n)
+  {
+    /* end of input; reader has finished */
+    thr.join ();
+    head = h + 1;
+    eof = true;
+    return 0;
+  }
+  held = true;
+  ptr = blocks + (h % RA_BLOCKS) * INBUF_SIZE;
+  end = ptr + n;
+  return n;
+}
+#endif
+
+/*!
+  Create an input stream for a file.
+
+  If `window` is not 0, regular files are memory-mapped in windows of this
+  size. Anything else (pipes, terminals, redirection functions) is read in
+  blocks. If `async` is true, files and pipes are read by a background
+  thread instead. Terminals and redirection functions are never read ahead.
+*/
+InputStream* InputStream::open (FILE* f, inproc in, bool async, size_t window)
+{
+#ifndef _MSC_VER
+  if (async && !in && !isatty (fileno (f)))
+    return new AsyncStream (f);
+
+  struct stat st;
+  if (window && !in && f != stdin && !fstat (fileno (f), &st) && S_ISREG (st.st_mode))
+  {
+    off_t start = lseek (fileno (f), 0, SEEK_CUR);
+    if (start != (off_t)-1 && start < st.st_size)
+      return new MappedStream (f, start, st.st_size, window);
+  }
+#endif
+  return new InputStream (f, in);
+}
+
+#ifndef _MSC_VER
+/*!
+  Create an input stream for part of a regular file.
+
+  \param f      file to read from
+  \param start  offset of first character
+  \param end    offset past the last character
+  \param window size of mapping window or 0 to read blocks
+*/
+InputStream* InputStream::open (FILE* f, off_t start, off_t end, size_t window)
+{
+  return new MappedStream (f, start, end, window);
+}
+#endif
+
+/*!
+  Create a block-buffered input stream.
+
+  \param f       file to read from
+  \param in      input redirection function. If not null, data is obtained
+                 from this function instead of the file.
+  \param bufsize size of input buffer
+*/
+InputStream::InputStream (FILE* f, inproc in, size_t bufsize)
+  : fp{ f }
+  , redir{ in }
+  , buf{ bufsize ? new char[bufsize] : nullptr }
+  , ptr{ buf }
+  , end{ buf }
+  , eof{ false }
+{
+}
+
+InputStream::~InputStream ()
+{
+  delete[] buf;
+}
+
+/// Refill the buffer. Returns number of characters available
+size_t InputStream::fill ()
+{
+  ptr = end = buf;
+  if (eof)
+    return 0;
+
+  size_t n = 0;
+  if (redir)
+  {
+    /* don't ask for more than a line so interactive sources are not blocked */
+    int c;
+    while (n < INBUF_SIZE && (c = redir ()) != EOF)
+    {
+      buf[n++] = (char)c;
+      if (c == '\n')
+        break;
+    }
+  }
+  else
+  {
+    int ret;
+    do
+      ret = read (fileno (fp), buf, INBUF_SIZE);
+    while (ret < 0 && errno == EINTR);
+    if (ret > 0)
+      n = ret;
+  }
+  if (!n)
+    eof = true;
+  end = buf + n;
+  return n;
+}
+
+/*!
+  Read one record terminated by character `sep`.
+
+  \param rec  record content (without separator)
+  \param sep  record separator
+  \return     `true` if a record was read, `false` at end of input
+*/
+bool InputStream::getrec (std::string& rec, int sep)
+{
+  rec.clear ();
+  while (ptr < end || fill ())
+  {
+    const char* p = (const char*)memchr (ptr, sep, end - ptr);
+    if (p)
+    {
+      rec.append (ptr, p - ptr);
+      ptr = p + 1;
+      return true;
+    }
+    rec.append (ptr, end - ptr);
+    ptr = end;
+  }
+  eof = false;  //let the next read try again
+  return !rec.empty ();
+}
+
+/*!
+  Read one record in paragraph mode (RS is empty).
+
+  Records are separated by one or more empty lines. Leading newlines
+  are skipped.
+*/
+bool InputStream::getpara (std::string& rec)
+{
+  rec.clear ();
+
+  /* skip leading \n's */
+  while (ptr < end || fill ())
+  {
+    if (*ptr != '\n')
+      break;
+    ptr++;
+  }
+
+  while (ptr < end || fill ())
+  {
+    const char* p = (const char*)memchr (ptr, '\n', end - ptr);
+    if (!p)
+    {
+      rec.append (ptr, end - ptr);
+      ptr = end;
+      continue;
+    }
+    rec.append (ptr, p - ptr);
+    ptr = p + 1;
+    if (ptr == end && !fill ())
+      break;
+    if (*ptr == '\n')
+    {
+      ptr++;  /* 2 in a row */
+      return true;
+    }
+    rec.push_back ('\n');
+  }
+  eof = false;
+  return !rec.empty ();
+}
@@ -2,34 +2,40 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <limits.h>
 #include <mutex>
+#ifndef _MSC_VER
+#include <sys/stat.h>
+#endif
 
 #include "awk.h"
 #include "ytab.h"
 #include "proto.h"
 #include <awklib/err.h>
+#include <awklib/awk.h>
 
 #define  DEFAULT_FLD  2         // Initial number of fields
 #define  DEFAULT_ARGV 3         // Initial number of entries in ARGV
-#define  NFA  20                // Cache this many dynamic regex's
+#define  NFA  64                // Default number of cached dynamic regex's
 
 using namespace std;
 
 static int file_cmp (const char* f1, const char* f2);
 
-Cell* literal_null;
-Cell* literal0;
-
 extern string curfname;  ///<current function name
-extern Interpreter* interp;
 
 Interpreter::Interpreter ()
-  : status{ AWKS_INIT }
+  : engine{ AWK_ENGINE_TREE }
+  , nworkers{ 1 }
+  , readahead{ false }
+  , mapwin{ 0 }
+  , status{ AWKS_INIT }
   , err{ 0 }
   , first_run{ true }
   , lineno{ 1 }
   , symtab{ new Array (NSYMTAB) }
   , prog_root{ 0 }
+  , program{ 0 }
   , argno{ 1 }
   , envir{ 0 }
   , argvtab{ 0 }
@@ -42,12 +48,26 @@ Interpreter::Interpreter ()
   , files{ 0 }
   , nfiles{ FOPEN_MAX }
   , infile{ 0 }
+  , nextin{ 0 }
   , inredir{ 0 }
   , outredir{ 0 }
-  , donerec{ false }
+  , sp{ 0 }
+  , donerec{ true }
   , donefld{ false }
+  , donenf{ false }
+  , nsplit{ 0 }
+  , maxsplit{ 0 }
+  , maxfld{ 0 }
+  , recgen{ 1 }
+  , patgen{ 0 }
+  , racap{ NFA }
+  , rahits{ 0 }
+  , ramisses{ 0 }
+  , splitpos{ 0 }
+  , splitsep{ ' ' }
 {
   *errmsg = 0;
+  ::interp = this;  // cells created below come from this interpreter's pool
   syminit ();
   envinit ();
 
@@ -90,6 +110,10 @@ Interpreter::~Interpreter ()
   delete progs;
   delete lexprog;
   delete files;
+  for (auto p : tmpcells)
+    delete p;
+  if (program)
+    program->release ();
 }
 
 /// Initialize symbol table with built-in vars
@@ -137,12 +161,12 @@ void Interpreter::envinit ()
       continue;
     if (p == *envp) /* no left hand side name in env string */
       continue;
-    *p++ = 0;  /* split into two strings at = */
+    /* environment is shared with other threads; don't write into it */
+    string name (*envp, p++ - *envp);
     if (is_number (p))
-      envtab->setsym (*envp, p, atof (p), STR | NUM);
+      envtab->setsym (name.c_str (), p, atof (p), STR | NUM);
     else
-      envtab->setsym (*envp, p, 0.0, STR);
-    p[-1] = '=';  /* restore in case env is passed down to a shell */
+      envtab->setsym (name.c_str (), p, 0.0, STR);
   }
 }
 
@@ -170,6 +194,8 @@ void Interpreter::std_redirect (int nf, const char* fname)
     return; //same file
 
   FILE_STRUC& fs = files[nf];
+  if (nf == 0)
+    closein (fs.fp);
   if (!strcmp (fname, "-"))
   {
     f = (nf == 0) ? stdin :
@@ -225,8 +251,14 @@ void Interpreter::run ()
   if (!first_run)
     clean_symtab ();
   initgetrec ();
+  outbuf.clear ();  //leftovers of a print interrupted by an error
 
-  execute (prog_root);
+  if (nworkers > 1)
+    parallel ();
+  else if (code[1])
+    runcode ();
+  else
+    execute (prog_root);
   if (err < 0)
     status = AWKS_DONE;
   else
@@ -239,9 +271,19 @@ void Interpreter::closeall ()
 {
   int i, stat;
 
+  //input file left open if program exited early
+  if (infile && infile != files[0].fp && infile != stdin)
+  {
+    closein (infile);
+    fclose (infile);
+  }
+  infile = NULL;
+  dropnext ();
+
   //skip stdin, stdout and stderr
   if (files[0].fp != stdin)
   {
+    closein (files[0].fp);
     fclose (files[0].fp);
     files[0].fp = 0;
   }
@@ -259,6 +301,7 @@ void Interpreter::closeall ()
   {
     if (files[i].fp)
     {
+      closein (files[i].fp);
       if (ferror (files[i].fp))
         WARNING ("i/o error occurred on %s", files[i].fname);
       if (files[i].mode == '|' || files[i].mode == LE)
@@ -305,6 +348,7 @@ void Interpreter::clean_symtab ()
   MY_OFMT = MY_CONVFMT = "%.6g";
   MY_SUBSEP = "\034";
   MY_FILENAME.clear();
+  fldtab[0]->setsval ("");  //no record yet
   dprintf ("Done symtab cleanup\n");
 }
 /// Find first filename argument
@@ -313,6 +357,7 @@ void Interpreter::initgetrec ()
   int i;
   const char* p;
 
+  infile = NULL;
   argno = 1;
   CELL_FNR->setfval (0.);
   CELL_NR->setfval (0.);
@@ -327,11 +372,7 @@ void Interpreter::initgetrec ()
     if (isclvar (p))
       setclvar (p);  /* a command line assignment before filename */
     else
-    {
-      if ((infile = fopen (p, "r")) == NULL)
-        FATAL (AWK_ERR_INFILE, "can't open file %s", infile);
-      return;
-    }
+      return;   /* getrec will open it */
     argno++;
   }
   infile = files[0].fp;    /* no filenames, so use stdin (or its redirect)*/
@@ -348,6 +389,7 @@ bool Interpreter::getrec (Cell* cell)
   {
     donefld = false;
     donerec = true;
+    recgen++;
   }
   while (argno < (int)MY_ARGC || infile == files[0].fp)
   {
@@ -373,9 +415,16 @@ bool Interpreter::getrec (Cell* cell)
       dprintf ("opening file %s\n", file);
       if (*file == '-' && *(file + 1) == '\0')
         infile = stdin;
+      else if (nextin && nextname == file)
+      {
+        infile = nextin;  //already opened by prefetch
+        nextin = NULL;
+      }
       else if ((infile = fopen (file, "r")) == NULL)
         FATAL (AWK_ERR_INFILE, "can't open file %s", file);
       MY_FNR = 0;
+      if (readahead)
+        prefetch ();
     }
     if (readrec (cell, infile))
     {
@@ -392,62 +441,93 @@ bool Interpreter::getrec (Cell* cell)
 void Interpreter::nextfile ()
 {
   if (infile != NULL && infile !=files[0].fp)
+  {
+    closein (infile);
     fclose (infile);
+  }
   infile = NULL;
   argno++;
 }
 
-/// Get input char from input file or from input redirection function
-int Interpreter::getchar (FILE* inf)
-{
-  int c = (inf == files[0].fp && inredir) ? inredir () : getc (inf);
-  return c;
-}
+/*!
+  Open the input file that follows the current one and start reading it.
 
-/// Read one record in cell's string value
-bool Interpreter::readrec (Cell* cell, FILE* inf)
+  Command line assignments between the two files are skipped; they are
+  executed by getrec as usual. If ARGV is changed in the meantime, getrec
+  ignores the prefetched file. Only regular files are prefetched; opening
+  a FIFO or a device could block. Files that cannot be opened are left for
+  getrec to report.
+*/
+void Interpreter::prefetch ()
 {
-  int sep, c;
+  dropnext ();
+  for (int i = argno + 1; i < (int)MY_ARGC; i++)
+  {
+    const char* file = getargv (i);
+    if (file == NULL || *file == '\0' || isclvar (file))
+      continue;
+    if (!strcmp (file, "-"))
+      return;
+#ifndef _MSC_VER
+    struct stat st;
+    if (stat (file, &st) || !S_ISREG (st.st_mode))
+      return;
+#endif
+    if ((nextin = fopen (file, "r")) != NULL)
+    {
+      nextname = file;
+      instream (nextin);
+    }
+    return;
+  }
+}
 
-  cell->sval.clear ();
+/*!
+  Discard the prefetched input file.
 
-  if (MY_RS.empty ())
+  Called whenever the program might have changed the file: when output
+  is flushed, files are opened or closed, or commands are executed.
+*/
+void Interpreter::dropnext ()
+{
+  if (nextin)
   {
-    sep = '\n';
-    while ((c = getchar (inf)) == '\n' && c != EOF)  /* skip leading \n's */
-      ;
-    if (c != EOF)
-      ungetc (c, inf);
+    closein (nextin);
+    fclose (nextin);
+    nextin = NULL;
   }
-  else
-    sep = MY_RS[0];
+}
 
-  while (1)
-  {
-    for (; (c = getchar (inf)) != sep && c != EOF; )
-      cell->sval.push_back (c);
+/// Return the buffered input stream associated with a file
+InputStream* Interpreter::instream (FILE* inf)
+{
+  auto& in = instreams[inf];
+  if (!in)
+    in.reset (InputStream::open (inf, (inf == files[0].fp) ? inredir : nullptr, readahead, mapwin));
+  return in.get ();
+}
 
-    if (MY_RS[0] == sep || c == EOF)
-      break;
+/// Discard the input buffer of a file that is about to be closed
+void Interpreter::closein (FILE* inf)
+{
+  instreams.erase (inf);
+}
 
-    /*
-      **RS != sep and sep is '\n' and c == '\n'
-      This is the case where RS = 0 and records are separated by two
-      consecutive \n
-    */
-    if ((c = getchar (inf)) == '\n' || c == EOF) /* 2 in a row */
-      break;
-    cell->sval.push_back ('\n');
-    cell->sval.push_back (c);
-  }
-  cell->flags = STR;
-  if (is_number (cell->sval))
+/*!
+  Read one record in cell's string value.
+
+  The cell is left unchanged if there are no more records.
+*/
+bool Interpreter::readrec (Cell* cell, FILE* inf)
+{
+  InputStream* in = instream (inf);
+  bool ret = MY_RS.empty () ? in->getpara (recbuf)
+                            : in->getrec (recbuf, MY_RS[0]);
+  if (ret)
   {
-    cell->fval = atof (cell->sval.c_str());
-    cell->flags |= NUM | CONVC;
+    cell->sval.swap (recbuf);
+    cell->flags = STR | NCHK;
   }
-
-  bool ret = c != EOF || !cell->sval.empty ();
   dprintf ("readrec saw <%s>, returns %s\n",
     cell->sval.c_str (), ret? "true" : "false");
   return ret;
@@ -469,13 +549,13 @@ const char* Interpreter::getargv (int n)
   return s;
 }
 
-// write string to output file or send it to output redirection function
-int Interpreter::putstr (const char* str, FILE* fp)
+/// Output a string of given length (not necessarily null-terminated)
+int Interpreter::putstr (const char* str, size_t len, FILE* fp)
 {
   if (fp == files[1].fp && outredir)
-    return outredir (str, strlen (str));
+    return outredir (str, len);
   else
-    return fputs (str, fp);
+    return (fwrite (str, 1, len, fp) == len) ? 1 : EOF;
 }
 
 
@@ -496,122 +576,192 @@ void Interpreter::setclvar (const char* s)
   s = qstring (s, '=');
   q = symtab->setsym (s, p, 0.0, STR);
   q->setsval (p);
-  if (is_number (q->sval))
-  {
-    q->fval = stof (q->sval);
-    q->flags |= NUM;
-  }
   dprintf ("command line set %s to |%s|\n", s, p);
 }
 
-/// Create fields from current record
+/// Split all fields of $0
 void Interpreter::fldbld ()
 {
-  char* fields, * fb, * fe, sep;
+  fldbld (INT_MAX);
+}
 
-  if (donefld)
+/*!
+  Split $0 into fields, at least up to field n.
+
+  Splitting stops after field `n` (or the highest constant field number used
+  by the program, if larger) and resumes from there when a later field is
+  needed. NF is known only after all fields have been split or after
+  nfbld() counted them.
+
+  Fields are not copied out of the record: each field cell keeps only the
+  offset and length of its value in $0 (see Cell::FVIEW). A field becomes
+  a separate string when its string value is needed or when $0 changes.
+*/
+void Interpreter::fldbld (int n)
+{
+  /* once NF is known, fields after it have been cleaned (here or in nfbld) */
+  if (donefld && (n <= nsplit || (donenf && nsplit == (int)MY_NF)))
     return;
 
-  fields = strdup (fldtab[0]->getsval ());
-  int i = 0;  /* number of fields accumulated here */
-  fb = fields;        //beginning of field
-  if (MY_FS.size() > 1)
+  const char* rec = fldtab[0]->getsval ();
+  if (!donefld)
   {
-    /* it's a regular expression */
-    i = refldbld (fields);
-  }
-  else if ((sep = MY_FS[0]) == ' ')
-  {
-    /* default whitespace */
-    for (i = 0; ; )
+    /* new record */
+    donefld = true;
+    donenf = false;
+    nsplit = 0;
+    splitpos = 0;
+    if (MY_FS.size () > 1)
     {
-      while (*fb && (*fb == ' ' || *fb == '\t' || *fb == '\n'))
-        fb++;
-      if (!*fb)
-        break;
-      fe = fb;        //end of field
-      while (*fe && *fe != ' ' && *fe != '\t' && *fe != '\n')
-        fe++;
-      if (*fe)
-        *fe++ = 0;
-      if (++i >= (int)fldtab.size())
-        growfldtab (i);
-      fldtab[i]->sval = fb;
-      fb = fe;
+      /* regular expression; split everything now */
+      nsplit = refldbld (rec, fldtab[0]->sval.size ());
+      cleanfld (nsplit + 1, maxsplit);
+      maxsplit = nsplit;
+      MY_NF = nsplit;
+      donenf = true;
+      n = 0;
     }
-  }
-  else if (!sep)
-  {
-    /* new: FS="" => 1 char/field */
-    for (i = 0; *fb != 0; fb++)
-    {
-      char buf[2];
-      if (++i >= (int)fldtab.size ())
-        growfldtab (i);
-      buf[0] = *fb;
-      buf[1] = 0;
-      fldtab[i]->sval = buf;
-    }
-  }
-  else if (*fb != 0)
-  {
-    /* if 0, it's a null field */
-
- /* subtlecase : if length(FS) == 1 && length(RS > 0)
-  * \n is NOT a field separator (cf awk book 61,84).
-  * this variable is tested in the inner while loop.
-  */
-    int rtest = '\n';  /* normal case */
-    int end_seen = 0;
-    if (MY_RS.size() > 0)
-      rtest = '\0';
-    fe = fb;
-    for (i = 0; !end_seen; )
+    else
     {
-      fb = fe;
-      while (*fe && *fe != sep && *fe != rtest)
-        fe++;
-      if (*fe)
-        *fe++ = 0;
+      splitsep = MY_FS[0];
+      size_t reclen = fldtab[0]->sval.size ();
+      if (splitsep == ' ')
+        splitscan.reset (rec, reclen, ' ', '\t', '\n');
+      else if (MY_RS.empty ())
+      {
+        /* subtlecase : if length(FS) == 1 && length(RS > 0)
+         * \n is NOT a field separator (cf awk book 61,84).
+         */
+        splitscan.reset (rec, reclen, splitsep, '\n', '\n');
+      }
       else
-        end_seen = 1;
-
-      if (++i >= (int)fldtab.size ())
-        growfldtab (i);
-      fldtab[i]->sval = fb;
+        splitscan.reset (rec, reclen, splitsep, splitsep, splitsep);
+      if (n < maxfld)
+        n = maxfld;
     }
   }
-  cleanfld (i + 1, (int)MY_NF);  /* clean out junk from previous record */
-  MY_NF = i;
-  donefld = true;
 
-  for (i = 1; i <= MY_NF; i++)
+  size_t off, len;
+  while (nsplit < n)
   {
-    assert (fldtab[i]);
-    fldtab[i]->flags = STR;
-    if (is_number (fldtab[i]->sval))
+    if (!nextfld (splitpos, off, len))
     {
-      fldtab[i]->fval = atof (fldtab[i]->sval.c_str());
-      fldtab[i]->flags |= (NUM | CONVC);
+      /* end of record */
+      cleanfld (nsplit + 1, maxsplit);  /* clean out junk from previous records */
+      maxsplit = nsplit;
+      MY_NF = nsplit;
+      donenf = true;
+      break;
     }
+    if (++nsplit >= (int)fldtab.size ())
+      growfldtab (nsplit);
+    setview (nsplit, off, len);
+    if (nsplit > maxsplit)
+      maxsplit = nsplit;
   }
   donerec = true; /* restore */
-  free (fields);
 #ifndef NDEBUG
   if (dbg)
   {
-    for (i = 0; i <= MY_NF; i++)
-      dprintf ("field %d (%s): |%s|\n", i, fldtab[i]->nval.c_str(), fldtab[i]->sval.c_str());
+    for (int i = 0; i <= nsplit; i++)
+    {
+      Cell* fp = fldtab[i].get ();
+      if (fp->isview ())
+        dprintf ("field %d (%s): |%.*s|\n", i, fp->nval.c_str (), (int)fp->view.len, rec + fp->view.off);
+      else
+        dprintf ("field %d (%s): |%s|\n", i, fp->nval.c_str (), fp->sval.c_str ());
+    }
   }
 #endif
 }
 
+/// Find NF without splitting the fields that are not needed yet
+void Interpreter::nfbld ()
+{
+  if (donefld && donenf)
+    return;
+  if (!donefld)
+    fldbld (0);
+  if (donenf)
+    return;
+
+  size_t pos = splitpos, off, len;
+  int n = nsplit;
+  while (nextfld (pos, off, len))
+    n++;
+  MY_NF = n;
+  donenf = true;
+
+  /* fields after NF may still be views of a previous record */
+  if (maxsplit > n)
+  {
+    cleanfld (n + 1, maxsplit);
+    maxsplit = n;
+  }
+}
+
+/*!
+  Find next field in record.
+
+  \param pos   position where search starts; updated to position after field
+  \param off   field offset
+  \param len   field length
+  \return      `false` if there are no more fields
+*/
+bool Interpreter::nextfld (size_t& pos, size_t& off, size_t& len)
+{
+  size_t fb, fe, reclen = splitscan.size ();
+
+  if (splitsep == ' ')
+  {
+    /* default whitespace */
+    fb = splitscan.skip (pos);
+    if (fb == reclen)
+      return false;
+    fe = splitscan.find (fb);
+    pos = fe;
+  }
+  else if (!splitsep)
+  {
+    /* new: FS="" => 1 char/field */
+    if (pos >= reclen)
+      return false;
+    fb = pos;
+    fe = pos = fb + 1;
+  }
+  else
+  {
+    /* pos past the end means last field ended the record */
+    if ((pos == 0 && !reclen) || pos > reclen)
+      return false;
+    fb = pos;
+    fe = splitscan.find (fb);
+    pos = fe + 1;
+  }
+  off = fb;
+  len = fe - fb;
+  return true;
+}
+
+/// Make field n a view of `len` characters starting at offset `off` in $0
+void Interpreter::setview (int n, size_t off, size_t len)
+{
+  Cell* fp = fldtab[n].get ();
+  fp->flags = STR | FVIEW | NCHK;
+  fp->view.off = (unsigned int)off;
+  fp->view.len = (unsigned int)len;
+}
+
 /// Create $0 from $1..$NF if necessary
 void Interpreter::recbld ()
 {
   if (donerec)
     return;
 
+  //detach fields from old record before it gets overwritten
+  for (int i = 1; i <= MY_NF; i++)
+    fldtab[i]->unview ();
+
   string& rec = fldtab[0]->sval;
   rec.clear ();
   for (int i = 1; i <= MY_NF; i++)
@@ -621,50 +771,48 @@ void Interpreter::recbld ()
       rec += MY_OFS;
   }
   dprintf ("in recbld $0=|%s|\n", rec.c_str());
-  fldtab[0]->flags = STR;
-  if (is_number (rec))
-  {
-    fldtab[0]->flags |= NUM;
-    fldtab[0]->fval = atof (rec.c_str());
-  }
+  fldtab[0]->flags = STR | NCHK;
 
   donerec = true;
+  recgen++;
 }
 
-/// Build fields from reg expr in FS
-int Interpreter::refldbld (const char* in)
+/*!
+  Split $0 in fields using a regular expression as field separator.
+
+  The record is scanned once, from left to right, and each field becomes
+  a view into $0.
+  \return number of fields
+*/
+int Interpreter::refldbld (const char* rec, size_t len)
 {
-  string rec = in;
-  if (rec.empty())
+  if (!len)
     return 0;
-  if (!CELL_FS->isregex ())
-  {
-    try {
-      CELL_FS->re = new regex (CELL_FS->sval, regex_constants::awk);
-    }
-    catch (exception& x) {
-      FATAL (AWK_ERR_SYNTAX, "Invalid regular expression - %s - %s", CELL_FS->sval.c_str(), x.what());
-    }
-  }
 
-  dprintf ("into refldbld, rec = <%s>, pat = <%s>\n", rec, CELL_FS->sval.c_str());
-  int i = 1;
-  size_t pstart, plen;
-  while (CELL_FS->pmatch (rec.c_str(), pstart, plen))
+  Cell* fsre = makedfa (MY_FS.c_str ());
+  dprintf ("into refldbld, rec = <%s>, pat = <%s>\n", rec, MY_FS.c_str ());
+
+  const char* p = rec;
+  const char* end = rec + len;
+  const char* q = p;
+  size_t start, mlen;
+  int i = 0;
+  while (q < end && fsre->re->pmatch (q, end - q, start, mlen, q > rec))
   {
-    if (i >= (int)fldtab.size ())
+    if (!mlen)
+    {
+      q += start + 1;  /* empty matches don't separate fields */
+      continue;
+    }
+    if (++i >= (int)fldtab.size ())
       growfldtab (i);
-    fldtab[i]->flags = STR;
-    fldtab[i]->sval = rec.substr (0, pstart);
-
-    dprintf ("match $%d = %s\n", i, fldtab[i]->sval.c_str());
-    rec = rec.substr (pstart + plen);
-    dprintf ("remaining <%s>\n", rec);
-    ++i;
+    setview (i, p - rec, q + start - p);
+    p = q = q + start + mlen;
   }
-  fldtab[i]->flags = STR;
-  fldtab[i]->sval = rec;
-  dprintf ("last field $%d = %s\n", i, fldtab[i]->sval.c_str ());
+  if (++i >= (int)fldtab.size ())
+    growfldtab (i);
+  setview (i, p - rec, end - p);
+  dprintf ("last field $%d = %.*s\n", i, (int)(end - p), p);
 
   return i;
 }
@@ -679,6 +827,7 @@ void Interpreter::cleanfld (int n1, int n2)
 /// Set last field cleaning fldtab cells if necessary
 void Interpreter::setlastfld (int n)
 {
+  fldbld ();
   if (n >= (int)fldtab.size ())
     growfldtab (n);
 
@@ -689,6 +838,7 @@ void Interpreter::setlastfld (int n)
     cleanfld (n + 1, lastfld);
 
   MY_NF = n;
+  nsplit = maxsplit = n;
 }
 
 /// Get nth field
@@ -696,9 +846,9 @@ Cell* Interpreter::fieldadr (int n)
 {
   if (n < 0)
     FATAL (AWK_ERR_ARG, "trying to access out of range field %d", n);
-  if (n && !donefld)
-    fldbld ();
-  else if (!n && !donerec)
+  if (n)
+    fldbld (n);
+  else if (!donerec)
     recbld ();
   if (n >= (int)fldtab.size())  /* fields after NF are empty */
     growfldtab (n);
@@ -725,63 +875,66 @@ Node* Interpreter::nodealloc (int n)
   return x;
 }
 
+/*!
+  Return the regex cell for a string.
+
+  While compiling, identical constant expressions share the same cell,
+  owned by the interpreter. At run time regular expressions are kept in a
+  cache of `racap` entries; the least recently used one is discarded when
+  the cache is full.
+*/
 Cell* Interpreter::makedfa (const char* s)
 {
-  string ss(s);
-  requote (ss);
-  Cell* x;
-  try {
-    if (status == AWKS_COMPILING)  /* a constant for sure */
+  if (status == AWKS_COMPILING)  /* a constant for sure */
+  {
+    auto& c = retab[s];
+    if (!c)
     {
-      // TODO reuse regex when compiling
-      regex* re = new regex (ss, regex_constants::awk);
-      Cell* x = new Cell (s, Cell::type::CELL, (CONST | REGEX));
-      x->re = re;
-      return x;
+      Dfa* re = new Dfa (s);
+      c = make_unique<Cell> (s, Cell::type::CELL, (CONST | REGEX));
+      c->re = re;
     }
-
-    for (int i = 0; i < (int)ratab.size (); i++)  /* is it there already? */
-    {
-      if (ratab[i]->nval == ss)
-      {
-        ratab[i]->fval += 1.;
-        return ratab[i].get ();
-      }
-    }
-
-    x = new Cell (s, Cell::type::CELL, REGEX);
-    x->re = new regex (ss, regex_constants::awk);
-  }
-  catch (std::exception& x) {
-    FATAL (AWK_ERR_SYNTAX, "Invalid regular expression - %s - %s", ss.c_str (), x.what());
+    return c.get ();
   }
 
-  if (ratab.size() < NFA)
+  if (!ralru.empty () && ralru.front ()->nval == s)
   {
-    /* room for another */
-    ratab.emplace_back (x);
-    return x;
+    rahits++;   /* same as last time */
+    return ralru.front ().get ();
   }
+  auto p = ratab.find (s);
+  if (p != ratab.end ())
+  {
+    rahits++;
+    ralru.splice (ralru.begin (), ralru, p->second);
+    return ralru.front ().get ();
+  }
+
+  ramisses++;
+  Dfa* re = new Dfa (s);
+  Cell* x = new Cell (s, Cell::type::CELL, REGEX);
+  x->re = re;
+  ralru.emplace_front (x);
+  ratab[x->nval] = ralru.begin ();
+  setrecache (racap);
+  return x;
+}
 
-  Awkfloat use = ratab[0]->fval;  /* replace least-recently used */
-  size_t nuse = 0;
-  for (size_t i = 1; i < ratab.size(); i++)
+/// Change capacity of dynamic regex cache, discarding entries if needed
+void Interpreter::setrecache (size_t size)
+{
+  racap = size ? size : 1;
+  while (ralru.size () > racap)
   {
-    if (ratab[i]->fval < use)
-    {
-      use = ratab[i]->fval;
-      nuse = i;
-    }
+    ratab.erase (ralru.back ()->nval);
+    ralru.pop_back ();
   }
-
-  ratab[nuse] = unique_ptr<Cell> (x);
-  return x;
 }
 
 /// Generate error message and throws an exception
 void FATAL (int err, const char* fmt, ...)
 {
-  static char errmsg[1024];
+  thread_local static char errmsg[1024];
   va_list varg;
   va_start (varg, fmt);
   vsprintf (errmsg, fmt, varg);
@@ -803,7 +956,7 @@ int file_cmp (const char* f1, const char* f2)
 void SYNTAX (const char* fmt, ...)
 {
   va_list varg;
-  static char errmsg[1024];
+  thread_local static char errmsg[1024];
   char* pb = errmsg;
   va_start (varg, fmt);
   pb += vsprintf (pb, fmt, varg);
@@ -31,7 +31,6 @@ THIS SOFTWARE.
 #include "proto.h"
 #include <awklib/err.h>
 
-extern Interpreter* interp;
 extern YYSTYPE  yylval;
 extern int  infunc;
 
@@ -777,7 +776,7 @@ const char *tokname (int n)
     { 0,         "" },
   };
 
-  static char buf[100];
+  thread_local static char buf[100];
   if (n < FIRSTTOKEN || n > LASTTOKEN)
   {
     sprintf (buf, "token %d", n);
@@ -127,3 +127,36 @@ bool is_number (const char *s)
   else
     return 0;
 }
+
+/*!
+  Check if the first `len` characters of `s` look like a number.
+
+  The string doesn't have to be null-terminated at `s+len` (it can be
+  a field inside a record). If it is a number, its value is returned
+  in `val`.
+*/
+bool is_number (const char* s, size_t len, Awkfloat& val)
+{
+  double r;
+  char *ep;
+  const char *end = s + len;
+
+  errno = 0;
+  r = strtod (s, &ep);
+  if (ep > end)
+  {
+    /* conversion ran past the end; try again on a terminated copy */
+    std::string tmp (s, len);
+    errno = 0;
+    r = strtod (tmp.c_str (), &ep);
+    ep = (char*)s + (ep - tmp.c_str ());
+  }
+  if (ep == s || r == HUGE_VAL || errno == ERANGE)
+    return false;
+  while (ep < end && (*ep == ' ' || *ep == '\t' || *ep == '\n'))
+    ep++;
+  if (ep != end)
+    return false;
+  val = r;
+  return true;
+}
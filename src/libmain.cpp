@@ -45,6 +45,7 @@ static const char  *version =
 #include <string.h>
 #include <signal.h>
 #include <mutex>
+#include <thread>
 #include "awk.h"
 #include "ytab.h"
 #include <awklib/awk.h>
@@ -55,8 +56,8 @@ static const char  *version =
 
 extern  FILE* yyin;     /* lex input file */
 
-Interpreter *interp;      ///< current interpreter status block
-std::mutex awk_in_use;
+thread_local Interpreter *interp;  ///< current interpreter of this thread
+std::mutex parser_lock;   ///< yacc parser and lexer keep their state in globals
 
 extern Node *winner;    // parser stores root of program tree here
 
@@ -69,6 +70,77 @@ extern int yydebug;
 #endif
 #endif
 
+/*!
+  Switches the numeric locale of the current thread to "C" while parsing, so
+  that other threads (and the host application) are not affected.
+*/
+class CNumeric {
+public:
+#ifdef _MSC_VER
+  CNumeric ()
+    : mode (_configthreadlocale (_ENABLE_PER_THREAD_LOCALE))
+    , old (setlocale (LC_NUMERIC, NULL))
+  {
+    setlocale (LC_NUMERIC, "C");
+  }
+  ~CNumeric ()
+  {
+    setlocale (LC_NUMERIC, old.c_str ());
+    _configthreadlocale (mode);
+  }
+private:
+  int mode;
+  std::string old;
+#else
+  CNumeric ()
+    : loc (newlocale (LC_NUMERIC_MASK, "C", duplocale (LC_GLOBAL_LOCALE)))
+    , old (uselocale (loc))
+  {}
+  ~CNumeric ()
+  {
+    uselocale (old);
+    if (loc)
+      freelocale (loc);
+  }
+private:
+  locale_t loc, old;
+#endif
+};
+
+/*!
+  Parse program of an interpreter.
+
+  The parser and the lexer keep their state in global variables so only one
+  program is parsed at a time. Once parsed, programs run in parallel.
+
+  \return root of program tree
+*/
+static Node* parse (Interpreter* ii)
+{
+  std::lock_guard<std::mutex> l (parser_lock);
+  setlocale (LC_CTYPE, "");
+  CNumeric cnum; /* for parsing cmdline & prog */
+
+  // (Re)init all parsing variables
+  yyinit ();
+  yyin = NULL;
+  ii->status = AWKS_COMPILING;
+  yyparse (ii);
+  return winner;
+}
+
+/// Add all user set variables ("var=value" strings)
+static void setvars (const char **vars)
+{
+  while (vars && *vars)
+  {
+    if (isclvar (*vars))
+      interp->setclvar (*vars++);
+    else
+      FATAL (AWK_ERR_INVVAR, "invalid variable argument: %s", *vars);
+  }
+}
+
 /*!
   Initialize interpreter and optionally sets user defined variables
   vars - array of strings "var=value"
@@ -80,17 +152,8 @@ AWKINTERP* awk_init (const char **vars)
 {
   signal (SIGFPE, fpecatch);
   try {
-    std::lock_guard<std::mutex> l (awk_in_use);
     interp = new Interpreter ();
-
-    //add all user set variables
-    while (vars && *vars)
-    {
-      if (isclvar (*vars))
-        interp->setclvar (*vars++);
-      else
-        FATAL (AWK_ERR_INVVAR, "invalid variable argument: %s", vars);
-    }
+    setvars (vars);
   }
   catch (awk_exception&)
   {
@@ -105,7 +168,6 @@ AWKINTERP* awk_init (const char **vars)
 */
 int awk_setprog (AWKINTERP *pinter, const char *prog)
 {
-  std::lock_guard<std::mutex> l (awk_in_use);
   interp = (Interpreter*)pinter;
   try {
     if (interp->status != AWKS_INIT)
@@ -127,7 +189,6 @@ int awk_setprog (AWKINTERP *pinter, const char *prog)
 */
 int awk_addprogfile (AWKINTERP *pinter, const char *progfile)
 {
-  std::lock_guard<std::mutex> l (awk_in_use);
   interp = (Interpreter*)pinter;
   try {
     if (interp->status != AWKS_INIT)
@@ -156,7 +217,6 @@ int awk_addprogfile (AWKINTERP *pinter, const char *progfile)
 */
 int awk_addarg (AWKINTERP *pinter, const char *arg)
 {
-  std::lock_guard<std::mutex> l (awk_in_use);
   interp = (Interpreter*)pinter;
   if (interp->status >= AWKS_RUN)
     return 0;
@@ -175,31 +235,27 @@ int awk_addarg (AWKINTERP *pinter, const char *arg)
 /// Compile an AWK program
 int awk_compile (AWKINTERP *pinter)
 {
-  std::lock_guard<std::mutex> l (awk_in_use);
   Interpreter *ii = (Interpreter*)pinter;
+  interp = ii;
   try {
     if (ii->status != AWKS_INIT)
       FATAL (AWK_ERR_BADSTAT, "Bad interpreter status (%d)", ii->status);
     if (!ii->lexprog && !interp->nprog)
       FATAL (AWK_ERR_NOPROG, "No program file");
-    interp = ii;
-    setlocale (LC_CTYPE, "");
-    setlocale (LC_NUMERIC, "C"); /* for parsing cmdline & prog */
-
-    // (Re)init all parsing variables
-    yyinit ();
-    yyin = NULL;
-    ii->status = AWKS_COMPILING;
-    yyparse (ii);
-    setlocale (LC_NUMERIC, ""); /* back to whatever it is locally */
+    Node* root = parse (ii);
     if (ii->err == 0)
     {
+      root = optimize (root);
 #ifndef NDEBUG
       if (dbg > 2)
-        print_tree (winner, 1);
+        print_tree (root, 1);
 #endif
+      ii->prog_root = root;
+      if (ii->nworkers > 1)
+        ii->parcheck ();
       ii->status = AWKS_COMPILED;
-      ii->prog_root = winner;
+      if (ii->engine == AWK_ENGINE_VM)
+        ii->makecode ();
       return 1;
     }
   }
@@ -221,7 +277,6 @@ int awk_exec (AWKINTERP *pinter)
     return 0;
   }
 
-  std::lock_guard<std::mutex> l (awk_in_use);
   interp = ii;
   try {
     interp->run ();
@@ -240,29 +295,25 @@ int awk_exec (AWKINTERP *pinter)
 /// Compile and execute a program
 int awk_run (AWKINTERP* pinter, const char *progfile)
 {
-  std::lock_guard<std::mutex> l (awk_in_use);
   Interpreter *ii = (Interpreter*)pinter;
+  interp = ii;
   try {
     if (ii->status != AWKS_INIT)
       FATAL (AWK_ERR_BADSTAT, "Bad interpreter status (%d)", ii->status);
     ii->lexptr = ii->lexprog = tostring (progfile);
-    setlocale (LC_CTYPE, "");
-    setlocale (LC_NUMERIC, "C"); /* for parsing cmdline & prog */
-    interp = ii;
-    // (Re)init all parsing variables
-    yyinit ();
-    yyin = NULL;
-    ii->status = AWKS_COMPILING;
-    yyparse (ii);
-
-    setlocale (LC_NUMERIC, ""); /* back to whatever it is locally */
+    Node* root = parse (ii);
     if (ii->err == 0)
     {
+      root = optimize (root);
 #ifndef NDEBUG
       if (dbg > 2)
-        print_tree (winner, 1);
+        print_tree (root, 1);
 #endif
-      ii->prog_root = winner;
+      ii->prog_root = root;
+      if (ii->nworkers > 1)
+        ii->parcheck ();
+      if (ii->engine == AWK_ENGINE_VM)
+        ii->makecode ();
       ii->run ();
     }
   }
@@ -281,6 +332,128 @@ void awk_end (AWKINTERP *pinter)
   delete ii;
 }
 
+/*!
+  Set number of threads running the main rules of the program.
+
+  Must be called before compiling the program. If `nthreads` is 0, the
+  number of hardware threads is used.
+*/
+int awk_setparallel (AWKINTERP *pinter, int nthreads)
+{
+  interp = (Interpreter*)pinter;
+  try {
+    if (interp->status != AWKS_INIT)
+      FATAL (AWK_ERR_BADSTAT, "Bad interpreter status (%d)", interp->status);
+    if (nthreads < 0)
+      FATAL (AWK_ERR_ARG, "Invalid number of threads %d", nthreads);
+    if (!nthreads)
+      nthreads = (int)std::thread::hardware_concurrency ();
+    interp->nworkers = nthreads ? nthreads : 1;
+  }
+  catch (awk_exception& x) {
+    return x.err;
+  }
+  return 1;
+}
+
+/*!
+  Turn on or off reading of input files in a background thread.
+  Cannot be called while the program is running.
+*/
+int awk_setreadahead (AWKINTERP *pinter, int on)
+{
+  interp = (Interpreter*)pinter;
+  try {
+    if (interp->status != AWKS_INIT && interp->status != AWKS_COMPILED)
+      FATAL (AWK_ERR_BADSTAT, "Bad interpreter status (%d)", interp->status);
+    interp->closein (interp->files[0].fp);  //drop stream made with old setting
+    interp->readahead = (on != 0);
+  }
+  catch (awk_exception& x) {
+    return x.err;
+  }
+  return 1;
+}
+
+/*!
+  Set size of memory mapping window for input files (0 = don't map files).
+  Cannot be called while the program is running.
+*/
+int awk_setmmap (AWKINTERP *pinter, size_t window)
+{
+  interp = (Interpreter*)pinter;
+  try {
+    if (interp->status != AWKS_INIT && interp->status != AWKS_COMPILED)
+      FATAL (AWK_ERR_BADSTAT, "Bad interpreter status (%d)", interp->status);
+    interp->mapwin = window;
+  }
+  catch (awk_exception& x) {
+    return x.err;
+  }
+  return 1;
+}
+
+/*!
+  Turn an interpreter into a program that can be shared by many interpreters.
+
+  The interpreter is compiled if needed. If successful, the program takes
+  ownership of the interpreter and the caller should not use it anymore.
+
+  \return  - the program or NULL if compilation failed.
+*/
+AWKPROG* awk_program (AWKINTERP* pinter)
+{
+  Interpreter* ii = (Interpreter*)pinter;
+  if (ii->status == AWKS_INIT && !awk_compile (pinter))
+    return NULL;
+  if (ii->status != AWKS_COMPILED)
+  {
+    sprintf (ii->errmsg, "Bad interpreter status (%d)", ii->status);
+    ii->err = AWK_ERR_BADSTAT;
+    return NULL;
+  }
+  return (AWKPROG*)new Program (ii);
+}
+
+/*!
+  Make a new interpreter ready to run a program and optionally set user
+  defined variables.
+
+  The new interpreter can be used from any thread, independently of
+  other interpreters made from the same program.
+
+  \return  - an interpreter in compiled state or NULL if there was an error
+*/
+AWKINTERP* awk_init_with_program (AWKPROG* pprog, const char **vars)
+{
+  Program* pg = (Program*)pprog;
+  signal (SIGFPE, fpecatch);
+  Interpreter* ii = 0;
+  try {
+    ii = pg->instance ();
+    interp = ii;
+    setvars (vars);
+  }
+  catch (awk_exception&)
+  {
+    delete ii;
+    ii = 0;
+  }
+  interp = ii;
+  return (AWKINTERP*)ii;
+}
+
+/*!
+  Release a program.
+
+  Interpreters made from the program can still be used; resources are freed
+  after the last one has ended.
+*/
+void awk_program_end (AWKPROG* pprog)
+{
+  ((Program*)pprog)->release ();
+}
+
 /// Return last error code and optionally the last error message
 int awk_err (AWKINTERP* pinter, const char **msg)
 {
@@ -309,7 +482,9 @@ int awk_setdebug (int level)
 /// Redirect input to a user function
 void awk_infunc (AWKINTERP* pinter, inproc user_input)
 {
-  ((Interpreter*)pinter)->inredir = user_input;
+  interp = (Interpreter*)pinter;
+  interp->closein (interp->files[0].fp);  //drop data buffered from old source
+  interp->inredir = user_input;
 }
 
 /// Redirect output to a user function
@@ -345,7 +520,7 @@ int awk_redirect (AWKINTERP* pinter, int n, const char* fname)
 /// Retrieve a variable from symbol table
 int awk_getvar (AWKINTERP * pinter, awksymb * var)
 {
-  Interpreter *interp = (Interpreter*)pinter;
+  interp = (Interpreter*)pinter;
   var->flags = 0;
   try {
     Cell *cp = NULL;
@@ -357,6 +532,7 @@ int awk_getvar (AWKINTERP * pinter, awksymb * var)
       if (n >= 0 && n <= NF)
       {
         cp = interp->fldtab[n].get ();
+        cp->unview ();
         interp->donefld = interp->donerec = false; //
       }
     }
@@ -392,7 +568,7 @@ int awk_getvar (AWKINTERP * pinter, awksymb * var)
     var->flags &= ~(AWKSYMB_NUM | AWKSYMB_STR);
     var->fval = 0.;
     var->sval = NULL;
-    if (cp->flags & NUM)
+    if (cp->isnum ())
     {
       var->flags |= AWKSYMB_NUM;
       var->fval = cp->fval;
@@ -422,7 +598,7 @@ int awk_setvar (AWKINTERP * pinter, awksymb * var)
   if (var->flags & AWKSYMB_NUM) flags |= NUM;
   if (var->flags & AWKSYMB_STR) flags |= STR;
 
-  Interpreter *interp = (Interpreter*)pinter;
+  interp = (Interpreter*)pinter;
   try {
     if (var->name[0] == '$' && is_number (var->name+1)
      && interp->status == AWKS_RUN)
@@ -487,7 +663,6 @@ int awk_setvar (AWKINTERP * pinter, awksymb * var)
 
 int awk_addfunc (AWKINTERP *pinter, const char *fname, awkfunc fn, int nargs)
 {
-  std::lock_guard<std::mutex> l (awk_in_use);
   interp = (Interpreter*)pinter;
   try {
     Cell *cp = interp->symtab->setsym (fname, NULL, nargs);
@@ -503,6 +678,48 @@ int awk_addfunc (AWKINTERP *pinter, const char *fname, awkfunc fn, int nargs)
   return 1;
 }
 
+/*!
+  Set the number of dynamic regular expressions kept in cache.
+  Return previous cache size.
+*/
+int awk_setrecache (AWKINTERP *pinter, int size)
+{
+  Interpreter* ii = (Interpreter*)pinter;
+  int prev = (int)ii->racap;
+  ii->setrecache (size > 0 ? (size_t)size : 1);
+  return prev;
+}
+
+/// Retrieve hit and miss counts of dynamic regular expressions cache
+void awk_restats (AWKINTERP *pinter, unsigned long *hits, unsigned long *misses)
+{
+  Interpreter* ii = (Interpreter*)pinter;
+  if (hits)
+    *hits = ii->rahits;
+  if (misses)
+    *misses = ii->ramisses;
+}
+
+/*!
+  Select execution engine: parse tree walker or bytecode.
+  Must be called before the program is compiled.
+*/
+int awk_setengine (AWKINTERP *pinter, int engine)
+{
+  interp = (Interpreter*)pinter;
+  try {
+    if (interp->status != AWKS_INIT)
+      FATAL (AWK_ERR_BADSTAT, "Bad interpreter status (%d)", interp->status);
+    if (engine != AWK_ENGINE_TREE && engine != AWK_ENGINE_VM)
+      FATAL (AWK_ERR_ARG, "Invalid engine %d", engine);
+    interp->engine = engine;
+  }
+  catch (awk_exception& x) {
+    return x.err;
+  }
+  return 1;
+}
+
 
 /*!
   Get 1 character from awk program
@@ -561,7 +778,7 @@ int errprintf (const char *fmt, ...)
   va_start (args, fmt);
   int ret;
 #ifdef WIN32
-  static char buffer[1024];
+  thread_local static char buffer[1024];
   ret = vsnprintf (buffer, sizeof(buffer)-1, fmt, args);
   OutputDebugStringA (buffer);
 #else
@@ -598,7 +815,7 @@ void print_cell (Cell *c, int indent)
     dprintf ("%*cValue: %s(%lf)", indent, ' ', c->sval.c_str(), c->fval);
   if (!c->nval.empty())
     dprintf (" Name: %s", c->nval.c_str());
-  dprintf (" Next: %p\n", c->cnext);
+  dprintf ("\n");
 }
 
 void print_tree (Node *n, int indent)
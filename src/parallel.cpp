@@ -0,0 +1,524 @@
+/*!
+  \file parallel.cpp
+  \brief Running the main rules in several threads
+
+  When enabled with awk_setparallel(), input files are divided in chunks
+  and the main rules run for each chunk in a worker interpreter of its own.
+  BEGIN and END parts run in the original interpreter, before and after all
+  workers are done.
+
+  Only programs whose main rules don't depend on the order of records can
+  run this way. The main rules may change fields and local variables but
+  global variables can only be added to (`+=`, `-=`, `++`, `--`) and, if
+  they are, not read. Each worker starts with these variables empty and
+  their values are added to the ones of the original interpreter at the
+  end. Main rules cannot produce output, use getline, match(), NR or FNR,
+  range patterns, `exit` or `nextfile`. The compiler refuses programs that
+  break any of these rules.
+
+  Large regular files are divided in byte ranges aligned to record
+  boundaries (not on Windows). If input comes from standard input, or
+  variables are assigned between file names, the main rules run in the
+  original interpreter as usual.
+
+  (c) Mircea Neacsu 2019
+  See README file for full copyright information.
+*/
+#include <string.h>
+#include <set>
+#include <thread>
+#ifndef _MSC_VER
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#include "awk.h"
+#include "ytab.h"
+#include "proto.h"
+#include <awklib/err.h>
+
+using namespace std;
+
+#define PAR_CHUNK  (4 * 1024 * 1024)  /* smallest part of a file given to a worker */
+
+/// State of the parallel execution check
+struct ParCheck {
+  set<Cell*> adds;            //!< global variables only added to
+  set<Cell*> reads;           //!< global variables read
+  map<const Cell*, vector<bool>> funcs; //!< array parameters changed by each function
+  set<const Cell*> active;    //!< functions being checked
+  vector<bool>* params;       //!< array parameters changed by current function
+};
+
+static void node (const Node* n, ParCheck& pc);
+
+/// Check a list of nodes
+static void nodes (const Node* n, ParCheck& pc)
+{
+  for (; n; n = n->nnext)
+    node (n, pc);
+}
+
+/// Refuse to run the program in parallel
+static void refuse (const char* why, const string& name = string ())
+{
+  FATAL (AWK_ERR_PARALLEL, "main rules cannot run in parallel: %s%s", why, name.c_str ());
+}
+
+/// Check if cell is a global variable
+static bool isglobal (const Cell* c)
+{
+  return c->ctype == Cell::type::CELL && !(c->flags & (CONST | REGEX));
+}
+
+/// Record a variable being read
+static void use (Cell* c, ParCheck& pc)
+{
+  if (!isglobal (c))
+    return;
+  if (c == interp->CELL_NR || c == interp->CELL_FNR)
+    refuse ("they use NR or FNR");
+  if (!(c->flags & PREDEF))
+    pc.reads.insert (c);
+}
+
+/// Check an array that is changed (deleted, split into or passed to a function that changes it)
+static void arrtarget (const Node* a, ParCheck& pc)
+{
+  if (a->isvalue ())
+    refuse ("they change array ", a->to_cell ()->nval);
+  else if (a->proc == ::arg && pc.params && (size_t)a->iarg < pc.params->size ())
+    (*pc.params)[a->iarg] = true;
+}
+
+/// Check target of an assignment; `add` is true if value is only added to it
+static void target (const Node* t, bool add, ParCheck& pc)
+{
+  if (t->isvalue ())
+  {
+    Cell* c = t->to_cell ();
+    if (c->ctype == Cell::type::CNF || !isglobal (c))
+      return;
+    if (!add || (c->flags & PREDEF))
+      refuse ("they assign to ", c->nval);
+    pc.adds.insert (c);
+  }
+  else if (t->proc == ::array)
+  {
+    nodes (t->arg[1].get (), pc);   /* subscripts */
+    const Node* a = t->arg[0].get ();
+    if (add && a->isvalue ())
+      pc.adds.insert (a->to_cell ());
+    else
+      arrtarget (a, pc);
+  }
+  else if (t->proc != ::arg)
+    node (t, pc);                   /* field */
+}
+
+/// Check a call to a user defined function
+static void callfn (const Node* n, ParCheck& pc)
+{
+  Cell* fc = n->arg[0]->to_cell ();
+  if (fc->ctype != Cell::type::CFUNC || !fc->nodeptr)
+    refuse ("they call undefined function ", fc->nval);
+
+  vector<bool> changed;
+  if (pc.active.count (fc))
+    changed.assign ((size_t)fc->fval, true);  /* recursive call; assume the worst */
+  else
+  {
+    auto p = pc.funcs.find (fc);
+    if (p == pc.funcs.end ())
+    {
+      vector<bool> mine ((size_t)fc->fval, false);
+      vector<bool>* caller = pc.params;
+      pc.active.insert (fc);
+      pc.params = &mine;
+      nodes (fc->nodeptr, pc);
+      pc.params = caller;
+      pc.active.erase (fc);
+      p = pc.funcs.emplace (fc, mine).first;
+    }
+    changed = p->second;
+  }
+
+  size_t i = 0;
+  for (const Node* a = n->arg[1].get (); a; a = a->nnext, i++)
+  {
+    if (i < changed.size () && changed[i])
+    {
+      if (!a->isvalue ())
+        arrtarget (a, pc);
+      else if (isglobal (a->to_cell ()))
+        refuse ("they pass to a function that changes it array ", a->to_cell ()->nval);
+    }
+    node (a, pc);
+  }
+}
+
+/// Check a node and its descendants
+static void node (const Node* n, ParCheck& pc)
+{
+  if (n->isvalue ())
+  {
+    use (n->to_cell (), pc);
+    return;
+  }
+  Node::pfun p = n->proc;
+  const auto& a = n->arg;
+  if (p == printstat || p == awkprintf || p == closefile)
+    refuse ("they produce output");
+  else if (p == awkgetline)
+    refuse ("they use getline");
+  else if (p == matchfun)
+    refuse ("they call match, which sets RSTART and RLENGTH");
+  else if (p == dopa2)
+    refuse ("they have range patterns");
+  else if (p == jump && (n->iarg == EXIT || n->iarg == NEXTFILE))
+    refuse ("they use exit or nextfile");
+  else if (p == bltin && (n->iarg == FSYSTEM || n->iarg == FFLUSH
+                       || n->iarg == FRAND || n->iarg == FSRAND))
+    refuse ("they call system, fflush, rand or srand");
+
+  if (p == assign)
+  {
+    target (a[0].get (), n->iarg == ADDEQ || n->iarg == SUBEQ, pc);
+    nodes (a[1].get (), pc);
+  }
+  else if (p == incrdecr)
+    target (a[0].get (), true, pc);
+  else if (p == awkdelete)
+  {
+    arrtarget (a[0].get (), pc);
+    nodes (a[1].get (), pc);
+  }
+  else if (p == ::split)
+  {
+    nodes (a[0].get (), pc);
+    arrtarget (a[1].get (), pc);
+    nodes (a[2].get (), pc);
+  }
+  else if (p == ::sub || p == ::gsub)
+  {
+    for (int i = 0; i < 3; i++)
+      nodes (a[i].get (), pc);
+    target (a[3].get (), false, pc);
+  }
+  else if (p == instat)
+  {
+    target (a[0].get (), false, pc);
+    nodes (a[1].get (), pc);
+    nodes (a[2].get (), pc);
+  }
+  else if (p == call)
+    callfn (n, pc);
+  else
+  {
+    for (auto& x : a)
+      nodes (x.get (), pc);
+  }
+}
+
+/*!
+  Check if the main rules can run in parallel and find the variables
+  they add to.
+
+  Throws an AWK_ERR_PARALLEL error if the program doesn't qualify.
+*/
+void Interpreter::parcheck ()
+{
+  ParCheck pc;
+  pc.params = nullptr;
+  nodes (prog_root->arg[1].get (), pc);
+  for (auto c : pc.adds)
+  {
+    if (pc.reads.count (c))
+      refuse ("they add to and also read ", c->nval);
+  }
+  paradd.assign (pc.adds.begin (), pc.adds.end ());
+}
+
+/// Part of an input file read by a worker
+struct Chunk {
+  string fname;         //!< file name
+  int argn;             //!< ARGV index of file
+  off_t start, end;     //!< byte range (`end` is negative for whole file)
+  size_t nrec;          //!< records read
+  size_t worker;        //!< worker that read it
+};
+
+/// Run BEGIN (0), main rules (1) or END (2) part with the selected engine
+static Cell* part (Interpreter* ii, int i)
+{
+  return ii->code[i] ? ii->code[i]->run () : execute (ii->prog_root->arg[i]);
+}
+
+#ifndef _MSC_VER
+/// Return offset past the first separator found at or after `pos - 1`
+static off_t boundary (int fd, off_t pos, off_t size, char sep)
+{
+  char buf[4096];
+  off_t p = pos - 1;
+  while (p < size)
+  {
+    ssize_t n = pread (fd, buf, sizeof (buf), p);
+    if (n <= 0)
+      break;
+    const char* q = (const char*)memchr (buf, sep, n);
+    if (q)
+      return p + (q - buf) + 1;
+    p += n;
+  }
+  return size;
+}
+#endif
+
+/*!
+  Divide input files in chunks.
+
+  \return `false` if input must be read in order
+*/
+static bool chunks (Interpreter* ii, vector<Chunk>& out)
+{
+  if (ii->infile)
+    return false;   //BEGIN has started reading with getline
+
+  int argc = (int)ii->CELL_ARGC->fval;
+  for (int i = ii->argno; i < argc; i++)
+  {
+    const char* file = ii->getargv (i);
+    if (!file || !*file)
+      continue;
+    if (isclvar (file) || !strcmp (file, "-"))
+      return false;
+
+    FILE* f = fopen (file, "r");
+    if (!f)
+      FATAL (AWK_ERR_INFILE, "can't open file %s", file);
+#ifndef _MSC_VER
+    struct stat st;
+    const string& rs = ii->CELL_RS->sval;
+    if (!rs.empty () && !fstat (fileno (f), &st) && S_ISREG (st.st_mode)
+     && st.st_size > PAR_CHUNK)
+    {
+      off_t piece = st.st_size / (4 * ii->nworkers);
+      if (piece < PAR_CHUNK)
+        piece = PAR_CHUNK;
+      for (off_t s = 0, e; s < st.st_size; s = e)
+      {
+        e = (st.st_size - s > piece) ? boundary (fileno (f), s + piece, st.st_size, rs[0])
+                                     : st.st_size;
+        out.push_back (Chunk{ file, i, s, e, 0, 0 });
+      }
+    }
+    else
+#endif
+      out.push_back (Chunk{ file, i, 0, -1, 0, 0 });
+    fclose (f);
+  }
+  return !out.empty ();
+}
+
+/// Worker thread: run main rules for chunks not taken by other workers
+static void work (Interpreter* w, size_t id, vector<Chunk>* all,
+                  atomic<size_t>* next, atomic<bool>* failed)
+{
+  interp = w;
+  try {
+    size_t i;
+    Cell* rec = w->fldtab[0].get ();
+    while (!*failed && (i = (*next)++) < all->size ())
+    {
+      Chunk& ch = (*all)[i];
+      FILE* f = fopen (ch.fname.c_str (), "r");
+      if (!f)
+        FATAL (AWK_ERR_INFILE, "can't open file %s", ch.fname.c_str ());
+      FILENAME = ch.fname;
+#ifndef _MSC_VER
+      if (ch.end >= 0)
+        w->instreams[f].reset (InputStream::open (f, ch.start, ch.end, w->mapwin));
+#endif
+      ch.worker = id;
+      while (!*failed)
+      {
+        w->donefld = false;
+        w->donerec = true;
+        w->recgen++;
+        if (!w->readrec (rec, f))
+          break;
+        ch.nrec++;
+        if (w->prog_root->arg[1])
+          tempfree (part (w, 1));
+      }
+      w->closein (f);
+      fclose (f);
+    }
+  }
+  catch (awk_exception&)
+  {
+    *failed = true;
+  }
+}
+
+/// Delete a worker interpreter
+static void endworker (Interpreter* w)
+{
+  Interpreter* cur = interp;
+  interp = w;
+  delete w;
+  interp = cur;
+}
+
+/*!
+  Run main rules for all chunks in worker interpreters and add up the
+  results in the original interpreter.
+*/
+static void runworkers (Interpreter* ii, vector<Chunk>& all)
+{
+  vector<Interpreter*> workers;
+  size_t nw = (size_t)ii->nworkers < all.size () ? (size_t)ii->nworkers : all.size ();
+  try {
+    while (workers.size () < nw)
+    {
+      Interpreter* w = ii->clone ();
+      interp = ii;
+      workers.push_back (w);
+      for (auto c : w->paradd)
+      {
+        if (c->isarr ())
+        {
+          delete c->arrval;
+          c->arrval = new Array (NSYMTAB);
+        }
+        else
+        {
+          c->sval.clear ();
+          c->fval = 0.;
+        }
+      }
+    }
+  }
+  catch (awk_exception&)
+  {
+    interp = ii;
+    for (auto w : workers)
+      endworker (w);
+    throw;
+  }
+
+  atomic<size_t> next{ 0 };
+  atomic<bool> failed{ false };
+  vector<thread> threads;
+  for (size_t i = 0; i < nw; i++)
+    threads.emplace_back (work, workers[i], i, &all, &next, &failed);
+  for (auto& t : threads)
+    t.join ();
+
+  int code = 0;
+  char msg[sizeof (ii->errmsg)];
+  for (auto w : workers)
+  {
+    if (w->err < 0)
+    {
+      code = w->err;
+      strcpy (msg, w->errmsg);
+      break;
+    }
+  }
+
+  if (!code)
+  {
+    /* add up variables */
+    for (size_t i = 0; i < ii->paradd.size (); i++)
+    {
+      Cell* c = ii->paradd[i];
+      for (auto w : workers)
+      {
+        Cell* wc = w->paradd[i];
+        if (c->isarr ())
+        {
+          for (auto e : *wc->arrval)
+          {
+            Cell* d = c->arrval->setsym (e->nval.c_str (), "", 0., STR | NUM);
+            d->setfval (d->getfval () + e->getfval ());
+          }
+        }
+        else if (!(wc->flags & STR))
+          c->setfval (c->getfval () + wc->fval);
+      }
+    }
+
+    /* END sees the same NR, FNR, FILENAME and $0 as after reading in order */
+    size_t nr = 0, fnr = 0;
+    const Chunk* last = nullptr;
+    for (auto& ch : all)
+    {
+      nr += ch.nrec;
+      fnr = (ch.argn == all.back ().argn) ? fnr + ch.nrec : 0;
+      if (ch.nrec)
+        last = &ch;
+    }
+    NR += nr;
+    FNR = (Awkfloat)fnr;
+    FILENAME = all.back ().fname;
+    if (last)
+    {
+      Interpreter* w = workers[last->worker];
+      interp = w;
+      string s = w->fldtab[0]->getsval ();
+      interp = ii;
+      Cell* rec = ii->fldtab[0].get ();
+      rec->sval.swap (s);
+      rec->flags = STR | NCHK;
+      ii->donefld = false;
+      ii->donerec = true;
+      ii->recgen++;
+    }
+    ii->argno = (int)ARGC;
+  }
+
+  for (auto w : workers)
+    endworker (w);
+  if (code)
+    throw awk_exception (*ii, code, msg);
+}
+
+/*!
+  Run the program with main rules executed by worker threads.
+  Mirrors program() function.
+*/
+void Interpreter::parallel ()
+{
+  Cell* x;
+  bool exit_seen = false;
+
+  if (prog_root->arg[0])
+  {    /* BEGIN */
+    x = part (this, 0);
+    if (x->isexit ())
+      exit_seen = true;
+    else if (x->isjump ())
+      FATAL (AWK_ERR_SYNTAX, "illegal break, continue, next or nextfile from BEGIN");
+    tempfree (x);
+  }
+  if (!exit_seen && (prog_root->arg[1] || prog_root->arg[2]))
+  {
+    vector<Chunk> all;
+    if (chunks (this, all))
+      runworkers (this, all);
+    else
+    {
+      /* read input in order */
+      while (getrec (fldtab[0].get ()))
+        tempfree (part (this, 1));
+    }
+  }
+  if (prog_root->arg[2])
+  {    /* END */
+    x = part (this, 2);
+    if (x->isbreak () || x->isnext () || x->iscont ())
+      FATAL (AWK_ERR_SYNTAX, "illegal break, continue, next or nextfile from END");
+    tempfree (x);
+  }
+}
@@ -26,6 +26,8 @@ THIS SOFTWARE.
 #include <string.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <errno.h>
+#include <math.h>
 #include <awklib/err.h>
 
 #include "awk.h"
@@ -34,13 +36,10 @@ THIS SOFTWARE.
 
 using namespace std;
 
-extern Interpreter* interp;
-extern Cell* literal0;
-extern Cell* literal_null;
 
 #ifndef NDEBUG
 const char *tokname (int tok);
-int node_count = 0;
+thread_local int node_count = 0;
 #endif
 
 
@@ -98,10 +97,9 @@ Node::~Node ()
 #endif
     if (ntype == NVALUE)
     {
-      Cell* x = (Cell*)arg[0].release();
-      // Do not delete cell. It belongs to symtab...
-      if (x->isregex ()) //...unless it's a regex
-        delete x; //regular expressions are not part of symtab (for now)
+      // Do not delete cell. It belongs to symtab or, for regular
+      // expressions, to the interpreter
+      arg[0].release();
     }
     else
     {
@@ -228,12 +226,12 @@ Node *celltonode (Cell *a, Cell::type t, int flags)
 Node *rectonode ()  /* make $0 into a Node */
 {
   // MN - Is this really needed? Can't we use fldtab[0]?
-  return op1 (INDIRECT, indirect, celltonode (literal0));
+  return op1 (INDIRECT, indirect, celltonode (interp->literal0));
 }
 
 Node* nullnode ()  /* zero&null, converted into a node for comparisons */
 {
-  return celltonode (literal_null);
+  return celltonode (interp->literal_null);
 }
 
 /*TODO: Check if could use NF as an array. That would be bad!! */
@@ -255,16 +253,16 @@ Node* makearr (Node* p)
 }
 
 #define PA2NUM  50  /* max number of pat,pat patterns allowed */
-int  paircnt;    /* number of them in use */
-int  pairstack[PA2NUM];  /* state of each pat,pat */
 
 Node *pa2stat (Node *a, Node *b, Node *c)  /* pat, pat {...} */
 {
   Node *x;
+  int paircnt = (int)interp->pairstack.size ();
 
   x = new Node (PASTAT2, dopa2, paircnt, a, b, c);
-  if (paircnt++ >= PA2NUM)
+  if (paircnt >= PA2NUM)
     SYNTAX ("limited to %d pat,pat statements", PA2NUM);
+  interp->pairstack.push_back (0);
   x->ntype = NSTAT;
   return x;
 }
@@ -285,6 +283,46 @@ Node *linkum (Node *a, Node *b)
   return a;
 }
 
+/*!
+  Match /re/ patterns of all rules with one combined automaton.
+
+  Patterns of the form `/re/` (or `$0 ~ /re/`) are replaced by patmatch()
+  nodes that look up the result of scanning the record only once.
+*/
+void multipat (Node* rules)
+{
+  vector<Node*> pats;
+  vector<string> res;
+  for (Node* p = rules; p; p = p->nnext)
+  {
+    if (p->tokid != PASTAT || !p->arg[0])
+      continue;
+    Node* ne = p->arg[0].get ();  /* added by notnull */
+    if (ne->tokid != NE || ne->proc != relop)
+      continue;
+    Node* m = ne->arg[0].get ();
+    if (m->tokid != MATCH || m->proc != matchop || !m->arg[1])
+      continue;
+    Node* r = m->arg[0].get ();
+    if (r->tokid != INDIRECT || !r->arg[0]->isvalue ()
+     || r->arg[0]->to_cell () != interp->literal0)
+      continue;   /* not $0 */
+    pats.push_back (p);
+    res.push_back (m->arg[1]->to_cell ()->nval);
+  }
+  if (pats.size () < 2)
+    return;
+
+  interp->patdfa.reset (new Dfa (res));
+  for (size_t i = 0; i < pats.size (); i++)
+  {
+    Node* m = pats[i]->arg[0]->arg[0].release ();
+    pats[i]->arg[0].reset (m);
+    m->proc = patmatch;
+    m->iarg = (int)i;
+  }
+}
+
 void defn (Cell *v, Node *vl, Node *st)  /* turn on FCN bit in definition, */
 {          /*   body of function, arglist */
   Node *p;
@@ -321,3 +359,162 @@ int isarg (const char *s)    /* is s in argument list for current function? */
       return n;
   return -1;
 }
+
+/// Constant cell of a value node or NULL if node is not a constant
+static Cell* constcell (const Node* n)
+{
+  if (!n || !n->isvalue ())
+    return NULL;
+  Cell* c = n->to_cell ();
+  if ((c->flags & CONST) && !(c->flags & (ARR | REGEX)) && c->ctype == Cell::type::CELL)
+    return c;
+  return NULL;
+}
+
+/*!
+  Numeric constant resulting from folding.
+
+  Integer values get also their string value because it doesn't depend on
+  CONVFMT or OFMT. Other values are converted when used.
+*/
+static Cell* numconst (Awkfloat f)
+{
+  char name[40], s[40];
+  double ipart;
+
+  f += 0.0;   /* same as Cell::setfval */
+  snprintf (name, sizeof (name), "$const&%.17g", f);
+  if (modf (f, &ipart) == 0)
+  {
+    snprintf (s, sizeof (s), "%.30g", f);
+    return interp->symtab->setsym (name, s, f, NUM | STR | CONST);
+  }
+  return interp->symtab->setsym (name, "", f, NUM | CONST);
+}
+
+/// String constant resulting from folding
+static Cell* strconst (const std::string& s)
+{
+  return interp->symtab->setsym (("$const&\"" + s).c_str (), s.c_str (), 0.0, STR | CONST);
+}
+
+/// Try to evaluate an expression node at compile time
+static Cell* foldnode (Node* n)
+{
+  if (n->ntype != NEXPR)
+    return NULL;
+  for (auto& a : n->arg)
+  {
+    if (a && (!constcell (a.get ()) || a->nnext))
+      return NULL;
+  }
+
+  if (n->proc == arith)
+  {
+    Awkfloat i = n->arg[0]->to_cell ()->getfval (), j = 0;
+    if (n->iarg != UMINUS && n->iarg != UPLUS)
+      j = n->arg[1]->to_cell ()->getfval ();
+    if ((n->iarg == DIVIDE || n->iarg == MOD) && j == 0)
+      return NULL;  /* leave error for run time */
+    if (n->iarg == POWER)
+    {
+      /* leave domain and range errors for run time, where errcheck reports them */
+      errno = 0;
+      Awkfloat r = pow (i, j);
+      bool bad = errno || !isfinite (r) || (r == 0 && i != 0);
+      errno = 0;  /* errcheck would see it later */
+      if (bad)
+        return NULL;
+    }
+    return numconst (arithval (n->iarg, i, j));
+  }
+
+  /* string values of numbers that are not integers depend on CONVFMT */
+  for (auto& a : n->arg)
+  {
+    if (a && !(a->to_cell ()->flags & STR))
+      return NULL;
+  }
+  if (n->proc == cat)
+    return strconst (n->arg[0]->to_cell ()->sval + n->arg[1]->to_cell ()->sval);
+
+  if (n->proc == substr || n->proc == sindex
+   || (n->proc == bltin && (n->iarg == FLENGTH || n->iarg == FINT)))
+  {
+    Cell* c = NULL;
+    Cell* t = (*n->proc)(n->arg, n->iarg);
+    if ((t->flags & (NUM | STR)) == NUM)
+      c = numconst (t->fval);
+    else if ((t->flags & (NUM | STR)) == STR)
+      c = strconst (t->sval);
+    tempfree (t);
+    return c;
+  }
+  return NULL;
+}
+
+/*!
+  Fold constant subexpressions in a list of nodes.
+
+  \param n  first node in list
+  \return   new first node in list
+*/
+static Node* foldlist (Node* n)
+{
+  Node* first = n;
+  Node* prev = NULL;
+  while (n)
+  {
+    if (!n->isvalue ())
+    {
+      for (auto& a : n->arg)
+      {
+        if (a)
+          a.reset (foldlist (a.release ()));
+      }
+    }
+    Cell* c = foldnode (n);
+    if (c)
+    {
+      Node* v = celltonode (c);
+      v->lineno = n->lineno;
+      v->nnext = n->nnext;
+      n->nnext = NULL;
+      delete n;
+      n = v;
+      if (prev)
+        prev->nnext = v;
+      else
+        first = v;
+    }
+    prev = n;
+    n = n->nnext;
+  }
+  return first;
+}
+
+/*!
+  Optimize the program tree.
+
+  Constant subexpressions, in the main program and in functions, are
+  replaced by their values. String constants get also their numeric value
+  so it doesn't have to be converted every time it's used.
+*/
+Node* optimize (Node* root)
+{
+  root = foldlist (root);
+  for (auto p : *interp->symtab)
+  {
+    if (p->ctype == Cell::type::CFUNC && p->nodeptr)
+      p->nodeptr = foldlist (p->nodeptr);
+  }
+  for (auto p : *interp->symtab)
+  {
+    if ((p->flags & (CONST | NUM | STR | REGEX)) == (CONST | STR))
+    {
+      p->fval = p->sval.empty () ? 0. : atof (p->sval.c_str ());
+      p->flags |= NCONV;
+    }
+  }
+  return root;
+}
@@ -0,0 +1,178 @@
+/*!
+  \file program.cpp
+  \brief Compiled programs shared by many interpreters
+
+  A program is compiled once by an interpreter that never runs. Each
+  interpreter made from the program gets a copy of the symbol table and of
+  the parse tree, with the cells of the original replaced by its own. This
+  is much cheaper than lexing, parsing and optimizing the program again.
+
+  The original interpreter is only read while making copies, so many
+  threads can make interpreters from the same program at the same time.
+
+  (c) Mircea Neacsu 2019
+  See README file for full copyright information.
+*/
+#include <unordered_map>
+
+#include "awk.h"
+#include "proto.h"
+
+typedef std::unordered_map<const Cell*, Cell*> CellMap;
+
+/// Take ownership of a compiled interpreter
+Program::Program (Interpreter* ii)
+  : templ{ ii }
+  , refs{ 1 }
+{
+}
+
+Program::~Program ()
+{
+  Interpreter* cur = interp;
+  interp = templ;
+  delete templ;
+  interp = cur;
+}
+
+/// Drop one reference to the program
+void Program::release ()
+{
+  if (--refs == 0)
+    delete this;
+}
+
+/// Copy elements of an array
+static Array* copyarray (const Array* a)
+{
+  Array* r = new Array (NSYMTAB);
+  for (auto p : *a)
+  {
+    if (p->isarr ())
+      r->setsym (p->nval.c_str (), copyarray (p->arrval), 0);
+    else
+      r->setsym (p->nval.c_str (), p->sval.c_str (), p->fval, p->flags & (NUM | STR));
+  }
+  return r;
+}
+
+/// Copy a list of nodes, replacing the cells they refer to
+static Node* copytree (const Node* n, const CellMap& map)
+{
+  Node* first = NULL;
+  Node** link = &first;
+  for (; n; n = n->nnext)
+  {
+    Node* c = new Node ();
+    c->ntype = n->ntype;
+    c->proc = n->proc;
+    c->lineno = n->lineno;
+    c->tokid = n->tokid;
+    c->iarg = n->iarg;
+    if (n->isvalue ())
+    {
+      /* cells not found in map (true, false) are shared by everybody */
+      Cell* v = n->to_cell ();
+      auto p = map.find (v);
+      c->arg.push_back (std::unique_ptr<Node> ((Node*)(p == map.end () ? v : p->second)));
+    }
+    else
+    {
+      c->arg.reserve (n->arg.size ());
+      for (auto& a : n->arg)
+        c->arg.push_back (std::unique_ptr<Node> (a ? copytree (a.get (), map) : NULL));
+    }
+    *link = c;
+    link = &c->nnext;
+  }
+  return first;
+}
+
+/*!
+  Make a new interpreter with a copy of this one's program and variables.
+
+  The new interpreter is in `AWKS_COMPILED` state. This interpreter is only
+  read; it must not run at the same time.
+*/
+Interpreter* Interpreter::clone ()
+{
+  Interpreter* ii = new Interpreter ();
+  CellMap map;
+
+  try {
+    /* built-in variables are already there; add all the others */
+    for (auto t : *symtab)
+    {
+      Cell* c = ii->symtab->lookup (t->nval.c_str ());
+      if (c)
+      {
+        /* built-in variable; keep the value it has here */
+        if (c->ctype == Cell::type::CELL && !c->isarr () && !t->isarr ())
+          *c = *t;
+      }
+      else
+      {
+        if (t->isarr ())
+          c = ii->symtab->setsym (t->nval.c_str (), copyarray (t->arrval), t->flags);
+        else
+        {
+          c = ii->symtab->setsym (t->nval.c_str (), t->sval.c_str (), t->fval, t->flags);
+          c->ctype = t->ctype;
+          if (t->ctype == Cell::type::EXTFUNC)
+            c->funptr = t->funptr;
+        }
+      }
+      map[t] = c;
+    }
+
+    /* constant regular expressions; copying is cheaper than building them */
+    for (auto& r : retab)
+    {
+      auto& c = ii->retab[r.first];
+      c = std::make_unique<Cell> (r.first.c_str (), Cell::type::CELL, (CONST | REGEX));
+      c->re = new Dfa (*r.second->re);
+      map[r.second.get ()] = c.get ();
+    }
+
+    for (auto t : *symtab)
+    {
+      if (t->ctype == Cell::type::CFUNC)
+        map[t]->nodeptr = copytree (t->nodeptr, map);
+    }
+    ii->prog_root = copytree (prog_root, map);
+
+    ii->pairstack.assign (pairstack.size (), 0);
+    ii->maxfld = maxfld;
+    ii->nworkers = nworkers;
+    ii->readahead = readahead;
+    ii->mapwin = mapwin;
+    for (auto c : paradd)
+      ii->paradd.push_back (map[c]);
+    if (patdfa)
+      ii->patdfa.reset (new Dfa (*patdfa));
+    ii->engine = engine;
+    ii->status = AWKS_COMPILED;
+    if (ii->engine == AWK_ENGINE_VM)
+      ii->makecode ();
+  }
+  catch (awk_exception&)
+  {
+    delete ii;
+    throw;
+  }
+
+  return ii;
+}
+
+/*!
+  Make a new interpreter that runs the program.
+
+  The new interpreter is in `AWKS_COMPILED` state.
+*/
+Interpreter* Program::instance ()
+{
+  Interpreter* ii = templ->clone ();
+  refs++;
+  ii->program = this;
+  return ii;
+}
@@ -43,14 +43,27 @@ THIS SOFTWARE.
 
 using namespace std;
 
-extern  int  pairstack[];
 extern  Awkfloat  srand_seed;
-extern Interpreter* interp;
+
+#define MAXTEMP 32  /* max number of released temporary cells kept for reuse */
+
+/*!
+  Boolean result shared by all interpreters.
+
+  It gets a string value so that reading it, from any thread, never
+  modifies it.
+*/
+static Cell* boolcell (Cell& c, const char* s)
+{
+  c.sval = s;
+  c.flags |= STR;
+  return &c;
+}
 
 static Cell  truecell ("true", Cell::type::BTRUE, NUM, 1.);
-Cell  *True  = &truecell;
+Cell  *True  = boolcell (truecell, "1");
 static Cell  falsecell ("false", Cell::type::BFALSE, NUM, 0.);
-Cell  *False  = &falsecell;
+Cell  *False  = boolcell (falsecell, "0");
 static Cell  breakcell  ("break", Cell::type::JBREAK);
 Cell  *jbreak  = &breakcell;
 static Cell  contcell ("continue", Cell::type::JCONT);
@@ -64,7 +77,6 @@ Cell  *jexit  = &exitcell;
 
 
 static int    format (char **, size_t *, const char *, Node *);
-static Cell*  gettemp ();
 
 /*! 
   Buffer memory management
@@ -139,6 +151,25 @@ Cell *execute (const Node* u)
   }
 }
 
+/// Execute only one node, without following the `nnext` chain
+Cell *execnode (const Node* a)
+{
+  Cell *x;
+  if (a->isvalue ())
+    x = a->to_cell ();
+  else
+  {
+    if (notlegal (a))
+      FATAL (AWK_ERR_SYNTAX, "illegal statement");
+    x = (*a->proc)(a->arg, a->iarg);
+  }
+  if (x->isfld () && !interp->donefld)
+    interp->fldbld ();
+  else if (x->isrec () && !interp->donerec)
+    interp->recbld ();
+  return x;
+}
+
 /// Execute an awk program
 //Cell *program (Node **a, int n)
 Cell* program (const Node::Arguments& a, int n)
@@ -179,15 +210,16 @@ Cell* program (const Node::Arguments& a, int n)
 /*!
   Function call
   a[0] - function, a[1] - args
+
+  Arguments live in slots of the interpreter's call stack. Each slot keeps
+  its own cell between calls so calling a function doesn't allocate memory.
 */
 Cell *call (const Node::Arguments& a, int n)
 {
   int i, ncall, ndef;
   Node *x;
   Frame frm;
-  Cell **callpar = NULL;
 
-  memset (&frm, 0, sizeof (frm));
   frm.fcn = execute (a[0]);  /* the function itself */
   if (!frm.fcn->isfcn ())
     FATAL (AWK_ERR_RUNTIME, "calling undefined function %s", frm.fcn->nval.c_str());
@@ -199,12 +231,13 @@ Cell *call (const Node::Arguments& a, int n)
     WARNING ("function %s called with %d args, uses only %d",
       frm.fcn->nval.c_str(), ncall, ndef);
 
-  frm.args = 0;
-  if (ndef)
-  {
-    frm.args = (Cell**)calloc (ndef, sizeof (Cell*));
-    callpar = (Cell**)calloc (ndef, sizeof(Cell*));
-  }
+  //reserve slots before evaluating arguments; they can call other functions
+  auto& stack = interp->callstack;
+  frm.base = interp->sp;
+  frm.nargs = ndef;
+  interp->sp += ndef;
+  while (stack.size () < interp->sp)
+    stack.push_back (Slot{ NULL, NULL, std::unique_ptr<Cell> (new Cell (NULL, Cell::type::CELL, STR)) });
 
   for (i = 0, x = a[1].get(); x != NULL; i++, x = x->nnext)
   {  /* get call args */
@@ -213,29 +246,30 @@ Cell *call (const Node::Arguments& a, int n)
       i, y->nval.c_str(), y->fval, y->isarr () ? "(array)" : y->sval.c_str(), flags2str (y->flags));
     if (y->isfcn ())
       FATAL (AWK_ERR_RUNTIME, "can't use function %s as argument in %s", y->nval.c_str(), frm.fcn->nval);
-    if (i < ndef)  // used arguments are stored in args array the rest are just
+    if (i < ndef)  // used arguments are stored in call stack the rest are just
     {              // evaluated (for eventual side effects)
-      callpar[i] = y;
+      Slot& s = stack[frm.base + i];
+      s.par = y->istemp () ? NULL : y;  //temporaries are gone after the call
       if (y->isarr ())
-        frm.args[i] = y;  // arrays by ref
+        s.arg = y;  // arrays by ref
       else
       {
-        frm.args[i] = new Cell ();
-        frm.args[i]->nval = y->nval;
-        *frm.args[i] = *y;
+        s.arg = s.own.get ();
+        s.arg->nval = y->nval;
+        *s.arg = *y;
       }
     }
     tempfree (y);
   }
 
   for (; i < ndef; i++)
-  {  /* add null args for ones not provided */
-    frm.args[i] = new Cell ();
-    frm.args[i]->flags = STR;
+  {  /* null args for ones not provided */
+    Slot& s = stack[frm.base + i];
+    s.arg = s.own.get ();
+    s.arg->nval.clear ();
+    s.par = NULL;
   }
 
-  frm.nargs = ndef;
-
   //save previous function call frame
   Frame prev = interp->fn;
 
@@ -247,26 +281,29 @@ Cell *call (const Node::Arguments& a, int n)
   if (frm.fcn->ctype == Cell::type::EXTFUNC)
   {
     //set args for external function
-    awksymb *extargs = (awksymb *)calloc (ndef, sizeof (awksymb));
+    auto& extargs = interp->extargs;
+    if (extargs.size () < (size_t)ndef)
+      extargs.resize (ndef);
     for (i = 0; i < ndef; i++)
     {
-      if (frm.args[i]->isarr())
+      Cell* t = stack[frm.base + i].arg;
+      extargs[i] = awksymb{ 0, 0, 0, 0., 0 };
+      if (t->isarr())
       {
         extargs[i].flags = AWKSYMB_ARR;
-        extargs[i].name = frm.args[i]->nval.c_str();
+        extargs[i].name = t->nval.c_str();
       }
       else
       {
-        extargs[i].sval = const_cast<char*>(frm.args[i]->getsval ());
-        extargs[i].fval = frm.args[i]->getfval ();
+        extargs[i].sval = const_cast<char*>(t->getsval ());
+        extargs[i].fval = t->getfval ();
         extargs[i].flags = AWKSYMB_NUM | AWKSYMB_STR;
       }
     }
     awksymb extret{ 0,0,0,0.,0 };
 
     //call external function
-    ((awkfunc)frm.fcn->funptr) ((AWKINTERP*)interp, &extret, ndef, extargs);
-    free (extargs);
+    ((awkfunc)frm.fcn->funptr) ((AWKINTERP*)interp, &extret, ndef, extargs.data ());
     result = new Cell ("", Cell::type::JRET);
     result->flags = 0;
     if (extret.flags & AWKSYMB_STR)
@@ -287,29 +324,27 @@ Cell *call (const Node::Arguments& a, int n)
   interp->fn = prev;    //restore previous function frame
   for (i = 0; i < ndef; i++)
   {
-    Cell* t = frm.args[i];
-    if (callpar[i])
+    Slot& s = stack[frm.base + i];
+    Cell* t = s.arg;
+    if (t != s.own.get ())
+      continue; // array coming in, array going out
+    if (t->isarr ())
     {
-      if (t->isarr ())
+      //array coming out of the function
+      if (s.par && !s.par->isarr ())
       {
-        //array coming out of the function
-        if (!callpar[i]->isarr ())
-        {
-          //scalar coming in
-          callpar[i]->sval.clear ();
-          callpar[i]->flags = t->flags;
-          callpar[i]->arrval = t->arrval;
-          t->arrval = 0; //make it safe for deletion
-        }
-        else
-          continue; // array coming in, array going out
+        //scalar coming in
+        s.par->sval.clear ();
+        s.par->flags = t->flags;
+        s.par->arrval = t->arrval;
       }
+      else
+        delete t->arrval;   //local array
     }
     //passed by value or local variable
-    delete t;
+    t->clear ();
   }
-  xfree (frm.args);
-  xfree (callpar);
+  interp->sp = frm.base;
   if (result->isexit () || result->isnext ())
     return result;
 
@@ -319,7 +354,7 @@ Cell *call (const Node::Arguments& a, int n)
   {
     //function without return
     tempfree (result);
-    result = literal_null;
+    result = interp->literal_null;
   }
 
   dprintf ("%s returns %g |%s| %s\n", frm.fcn->nval.c_str(), result->fval,
@@ -334,7 +369,7 @@ Cell *arg (const Node::Arguments& a, int n)
   if (n + 1 > interp->fn.nargs)
     FATAL (AWK_ERR_RUNTIME, "argument #%d of function %s was not supplied",
       n + 1, interp->fn.fcn->nval.c_str());
-  return interp->fn.args[n];
+  return interp->callstack[interp->fn.base + n].arg;
 }
 
 /// break, continue, next, nextfile, return
@@ -358,7 +393,7 @@ Cell *jump (const Node::Arguments& a, int n)
       if (a[0] != NULL)
         y = execute (a[0]);
       else
-        y = literal_null;
+        y = interp->literal_null;
       Cell* r = new Cell ("retval", Cell::type::JRET);
       *r = *y;
       tempfree (y);
@@ -390,12 +425,13 @@ Cell *awkgetline (const Node::Arguments& a, int n)
   /* a[0] is variable, a[1] is filename */
   Cell *r, *x;
   FILE *fp;
-  int mode, c;
+  int mode;
+  Awkfloat c;
 
   r = a[0] ? execute (a[0]) : interp->fldtab[0].get();
 
   fflush (interp->files[1].fp);  /* in case someone is waiting for a prompt */
-  if (a[2])
+  if (a[1])
   {    /* getline < file */
     x = execute (a[1]);    /* filename */
     mode = n;
@@ -404,7 +440,7 @@ Cell *awkgetline (const Node::Arguments& a, int n)
     fp = openfile (mode, x->getsval ());
     tempfree (x);
     if (fp == NULL)
-      c = 0;
+      c = -1;
     else
       c = interp->readrec (r, fp);
   }
@@ -412,50 +448,111 @@ Cell *awkgetline (const Node::Arguments& a, int n)
   {      /* bare getline; use current input */
     c = interp->getrec (r);
   }
-  if (c && is_number (r->sval))
-  {
-    r->fval = stof (r->sval);
-    r->flags |= NUM;
-  }
-  if (r->isrec())
+  if (c > 0 && r->isrec())
   {
+    interp->donefld = false;
     interp->donerec = true;
-    interp->fldbld ();
+    interp->recgen++;
   }
-  return r;
+  x = gettemp ();
+  x->setfval (c);
+  return x;
 }
 
 /// get NF
 Cell *getnf (const Node::Arguments& a, int)
 {
-  if (!interp->donefld)
-    interp->fldbld ();
+  interp->nfbld ();
   Cell *pnf = execute (a[0]);
   return pnf;
 }
 
+/// Check if a subscript is a non-negative integer and return its value in k
+static bool intsub (Cell* y, size_t& k)
+{
+  /* a number converts to "%.30g" format if integral */
+  if ((y->flags & NUM) && (!(y->flags & STR) || (y->flags & CONVC)))
+  {
+    Awkfloat f = y->getfval ();
+    if (f >= 0 && f < 2147483648. && !signbit (f) && f == (Awkfloat)(size_t)f)
+    {
+      k = (size_t)f;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*!
+  Evaluate a list of array subscripts.
+
+  If there is only one subscript and it is a non-negative integer, the
+  function returns `true` and puts its value in `k`. Otherwise it returns
+  `false` and `sub` is the subscripts string, joined by SUBSEP.
+*/
+static bool subscript (Node* np, string& sub, size_t& k)
+{
+  Cell* y;
+  if (!np->nnext)
+  {
+    y = execute (np);
+    bool isint = intsub (y, k);
+    if (!isint)
+      sub = y->getsval ();
+    tempfree (y);
+    return isint;
+  }
+  for (; np; np = np->nnext)
+  {
+    y = execute (np);
+    sub += y->getsval ();
+    if (np->nnext)
+      sub += SUBSEP;
+    tempfree (y);
+  }
+  return false;
+}
+
 /* a[0] ( a[1]...) a[0] array, a[1] is list of subscripts */
 Cell *array (const Node::Arguments& a, int)
 {
-  Cell *x, *y, *z;
-  Node *np;
+  Cell *x, *z;
+  string sub;
+  size_t k;
 
   x = execute (a[0]);  /* array */
-  string subscript;
-  for (np = a[1].get(); np; np = np->nnext)
+  bool isint = subscript (a[1].get (), sub, k);
+  if (!x->isarr ())
   {
-    y = execute (np);  /* subscript */
-    subscript += y->getsval ();
-    if (np->nnext)
-      subscript += SUBSEP;
-    tempfree (y);
+    dprintf ("making %s into an array\n", x->nval.c_str());
+    x->makearray ();
   }
+  if (isint)
+    z = x->arrval->setsym (k, "", 0.0, STR | NUM);
+  else
+    z = x->arrval->setsym (sub.c_str(), "", 0.0, STR | NUM);
+  tempfree (x);
+  return z;
+}
+
+/// Array element x[y] with only one subscript. Frees x and y.
+Cell *element (Cell* x, Cell* y)
+{
+  Cell *z;
+  size_t k;
+
+  bool isint = intsub (y, k);
+  const char* sub = isint ? NULL : y->getsval ();
   if (!x->isarr ())
   {
     dprintf ("making %s into an array\n", x->nval.c_str());
     x->makearray ();
   }
-  z = x->arrval->setsym (subscript.c_str(), "", 0.0, STR | NUM);
+  if (isint)
+    z = x->arrval->setsym (k, "", 0.0, STR | NUM);
+  else
+    z = x->arrval->setsym (sub, "", 0.0, STR | NUM);
+  tempfree (y);
   tempfree (x);
   return z;
 }
@@ -463,9 +560,7 @@ Cell *array (const Node::Arguments& a, int)
 Cell *awkdelete (const Node::Arguments& a, int)
 {
   /* a[0] is array, a[1] is list of subscripts */
-  Cell *x, *y;
-  Node *np;
-  size_t nsub = SUBSEP.size ();
+  Cell *x;
 
   x = execute (a[0]);  /* Cell* for array */
   if (!x->isarr ())
@@ -479,15 +574,11 @@ Cell *awkdelete (const Node::Arguments& a, int)
   else
   {
     string sub;
-    for (np = a[1].get(); np; np = np->nnext)
-    {
-      y = execute (np);  /* subscript */
-      sub += y->getsval ();
-      if (np->nnext)
-        sub += SUBSEP;
-      tempfree (y);
-    }
-    delete x->arrval->removesym (sub);
+    size_t k;
+    if (subscript (a[1].get (), sub, k))
+      delete x->arrval->removesym (k);
+    else
+      delete x->arrval->removesym (sub);
   }
   tempfree (x);
 
@@ -497,27 +588,21 @@ Cell *awkdelete (const Node::Arguments& a, int)
 Cell *intest (const Node::Arguments& a, int)
 {
   /* a[0] is index (list), a[1] is array */
-  Cell *x, *ap, *k;
-  Node *p;
-  size_t bufsz = RECSIZE;
-  size_t nsub = SUBSEP.size();
+  Cell *ap, *k;
 
   ap = execute (a[1]);  /* array name */
   if (!ap->isarr ())
   {
-    dprintf ("making %s into an array\n", ap->nval);
+    dprintf ("making %s into an array\n", ap->nval.c_str ());
     ap->makearray ();
   }
 
   string sub;
-  for (p = a[0].get(); p; p = p->nnext)
-  {
-    x = execute (p);  /* expr */
-    sub += x->getsval ();
-    if (p->nnext)
-      sub += SUBSEP;
-  }
-  k = ap->arrval->lookup (sub.c_str());
+  size_t idx;
+  if (subscript (a[0].get (), sub, idx))
+    k = ap->arrval->lookup (idx);
+  else
+    k = ap->arrval->lookup (sub.c_str (), sub.size ());
   tempfree (ap);
   if (k == NULL)
     return False;
@@ -544,8 +629,10 @@ Cell *matchop (const Node::Arguments& a, int n)
   else
   {
     y = execute (a[2]);  /* a[2] = regular expr */
+    /* get target first: splitting fields with a regex FS can evict `re` */
+    const char* s = x->getsval ();
     Cell* re = interp->makedfa (y->getsval ());
-    found = re->match(x->getsval());
+    found = re->match(s);
     tempfree (y);
   }
   tempfree (x);
@@ -555,6 +642,25 @@ Cell *matchop (const Node::Arguments& a, int n)
     return False;
 }
 
+/*
+  /re/ pattern matched together with patterns of other rules (see multipat)
+    a[0] = $0
+    a[1] = compiled regex
+    n = number of pattern in combined regex
+*/
+Cell* patmatch (const Node::Arguments& a, int n)
+{
+  Cell* x = execute (a[0]);
+  if (interp->patgen != interp->recgen)
+  {
+    const char* s = x->getsval ();
+    interp->patdfa->matchall (s, strlen (s), interp->patfound);
+    interp->patgen = interp->recgen;
+  }
+  tempfree (x);
+  return interp->patfound[n] ? True : False;
+}
+
 /*
   match ()
     a[0] = target text
@@ -570,12 +676,13 @@ Cell* matchfun (const Node::Arguments& a, int)
   size_t patbeg, patlen;
 
   x = execute (a[0]);  /* a[0] = target text */
-  const char *s = x->getsval ();
   if (a[1])    /* a[1] != 0: already-compiled reg expr */
-    found = a[1]->to_cell ()->pmatch(s, patbeg, patlen);
+    found = a[1]->to_cell ()->pmatch(x->getsval (), patbeg, patlen);
   else
   {
     y = execute (a[2]);  /* a[2] = regular expr */
+    /* get target first: splitting fields with a regex FS can evict `re` */
+    const char* s = x->getsval ();
     Cell* re = interp->makedfa (y->getsval ());
     found = re->pmatch(s, patbeg, patlen);
     tempfree (y);
@@ -587,11 +694,13 @@ Cell* matchfun (const Node::Arguments& a, int)
     RLENGTH = (Awkfloat)patlen;
   }
   else
+  {
     RSTART = 0.;
+    RLENGTH = -1.;
+  }
 
   x = gettemp ();
-  x->flags |= NUM;
-  x->fval = RSTART;
+  x->setfval (RSTART);
   return x;
 }
 
@@ -629,24 +738,26 @@ Cell *boolop (const Node::Arguments& a, int n)
   return 0;  /*NOTREACHED*/
 }
 
+/// Compare two cells, as numbers if both are numeric or as strings otherwise
+int compare (Cell* x, Cell* y)
+{
+  if (x->isnum () && y->isnum ())
+  {
+    Awkfloat j = x->fval - y->fval;
+    return j < 0 ? -1 : (j > 0 ? 1 : 0);
+  }
+  return strcmp (x->getsval (), y->getsval ());
+}
+
 /// Relational operators  a[0] < a[1], etc.
 Cell *relop (const Node::Arguments& a, int n)
 {
   int i;
   Cell *x, *y;
-  Awkfloat j;
 
   x = execute (a[0]);
   y = execute (a[1]);
-  if ((x->flags & NUM) && (y->flags & NUM))
-  {
-    j = x->fval - y->fval;
-    i = j < 0 ? -1 : (j > 0 ? 1 : 0);
-  }
-  else
-  {
-    i = strcmp (x->getsval (), y->getsval ());
-  }
+  i = compare (x, y);
   tempfree (x);
   tempfree (y);
   switch (n)
@@ -670,14 +781,28 @@ void tempfree (Cell *a)
   if (a->ctype == Cell::type::CTEMP)
   {
     dprintf ("freeing %s %s %s\n", a->nval.c_str(), quote (a->sval).c_str (), flags2str (a->flags));
-    delete a;
+    if ((a->flags & (ARR | REGEX)) || interp->tmpcells.size () >= MAXTEMP)
+    {
+      delete a;
+      return;
+    }
+    /* keep it, together with its string buffer, for the next gettemp */
+    a->flags = STR;
+    a->fval = 0;
+    a->funptr = nullptr;
+    a->sval.clear ();
+    a->nval.clear ();
+    interp->tmpcells.push_back (a);
   }
 }
 
 ///  Get a tempcell
 Cell *gettemp ()
 {
-  Cell *p =  new Cell (nullptr, Cell::type::CTEMP, STR);
+  if (interp->tmpcells.empty ())
+    return new Cell (nullptr, Cell::type::CTEMP, STR);
+  Cell* p = interp->tmpcells.back ();
+  interp->tmpcells.pop_back ();
   return p;
 }
 
@@ -803,8 +928,8 @@ int format (char **pbuf, size_t *pbufsize, const char *s, Node *a)
   char *buf = *pbuf;
   size_t bufsize = *pbufsize;
 
-  static int first = 1;
-  static int have_a_format = 0;
+  thread_local static int first = 1;
+  thread_local static int have_a_format = 0;
 
   if (first)
   {
@@ -926,7 +1051,7 @@ int format (char **pbuf, size_t *pbufsize, const char *s, Node *a)
       sprintf (p, fmt, os);
       break;
     case 'c':
-      if (x->flags & NUM)
+      if (x->isnum ())
       {
         if (x->getfval ())
           sprintf (p, fmt, (int)x->getfval ());
@@ -1009,7 +1134,6 @@ Cell *awkprintf (const Node::Arguments& a, int n)
   {
     fp = redirect (n, *a[1]);
     fwrite (buf, len, 1, fp);
-    fflush (fp);
     if (ferror (fp))
       FATAL (AWK_ERR_OUTFILE, "write error on %s", filename (fp));
   }
@@ -1021,7 +1145,6 @@ Cell *awkprintf (const Node::Arguments& a, int n)
 Cell *arith (const Node::Arguments& a, int n)
 {
   Awkfloat i, j = 0;
-  double v;
   Cell *x, *y, *z;
 
   x = execute (a[0]);
@@ -1034,6 +1157,14 @@ Cell *arith (const Node::Arguments& a, int n)
     tempfree (y);
   }
   z = gettemp ();
+  z->setfval (arithval (n, i, j));
+  return z;
+}
+
+/// Result of arithmetic operator n applied to i and j
+Awkfloat arithval (int n, Awkfloat i, Awkfloat j)
+{
+  double v;
   switch (n)
   {
   case ADD:
@@ -1067,8 +1198,7 @@ Cell *arith (const Node::Arguments& a, int n)
   default:  /* can't happen */
     FATAL (AWK_ERR_OTHER, "illegal arithmetic operator %d", n);
   }
-  z->setfval (i);
-  return z;
+  return i;
 }
 
 /// Increment/decrement operators a[0]++, etc.
@@ -1100,9 +1230,15 @@ Cell *assign (const Node::Arguments& a, int n)
   Cell *x, *y;
 
   y = execute (a[1]);
+  x = execute (a[0]);
+  return doassign (n, x, y);
+}
+
+/// Assignment x = y, x += y, etc. Frees y and returns x.
+Cell *doassign (int n, Cell* x, Cell* y)
+{
   if ((y->flags & (NUM | STR)) == 0)
     funnyvar (y, "assign");
-  x = execute (a[0]);
   if ((x->flags & (NUM | STR)) == 0)
     funnyvar (x, "assign");
   if (n == ASSIGN)
@@ -1111,8 +1247,16 @@ Cell *assign (const Node::Arguments& a, int n)
       To save some time we don't call Cell's get... and set... functions but
       we must take care of side-effects if cells are fields.
     */
+    if (x->isnf ())
+    {
+      /* changing NF changes $0 */
+      x->setfval (y->getfval ());
+      tempfree (y);
+      return x;
+    }
     if (x->isfld ())
     {
+      interp->fldbld ();  /* all fields are needed to rebuild $0 */
       int n = atoi (x->nval.c_str ());
       if (n > NF)
         interp->setlastfld (n);
@@ -1122,6 +1266,7 @@ Cell *assign (const Node::Arguments& a, int n)
     {
       interp->donefld = false;
       interp->donerec = true;
+      interp->recgen++;
     }
     if (x != y)  // leave alone self-assignment */
       *x = *y;
@@ -1131,42 +1276,48 @@ Cell *assign (const Node::Arguments& a, int n)
     /* Other assignment operations (+=, -=, etc.)*/
     Awkfloat xf = x->getfval (),
       yf = y->getfval ();
-    double v;
-    switch (n)
-    {
-    case ADDEQ:
-      xf += yf;
-      break;
-    case SUBEQ:
-      xf -= yf;
-      break;
-    case MULTEQ:
-      xf *= yf;
-      break;
-    case DIVEQ:
-      if (yf == 0)
-        FATAL (AWK_ERR_RUNTIME, "division by zero in /=");
-      xf /= yf;
-      break;
-    case MODEQ:
-      if (yf == 0)
-        FATAL (AWK_ERR_RUNTIME, "division by zero in %%=");
-      modf (xf / yf, &v);
-      xf = xf - yf * v;
-      break;
-    case POWEQ:
-      xf = errcheck (pow (xf, yf), "pow");
-      break;
-    default:
-      FATAL (AWK_ERR_OTHER, "illegal assignment operator %d", n);
-      break;
-    }
-    x->setfval (xf);
+    x->setfval (assignval (n, xf, yf));
   }
   tempfree (y);
   return x;
 }
 
+/// Result of assignment operator n (+=, -=, etc.) applied to xf and yf
+Awkfloat assignval (int n, Awkfloat xf, Awkfloat yf)
+{
+  double v;
+  switch (n)
+  {
+  case ADDEQ:
+    xf += yf;
+    break;
+  case SUBEQ:
+    xf -= yf;
+    break;
+  case MULTEQ:
+    xf *= yf;
+    break;
+  case DIVEQ:
+    if (yf == 0)
+      FATAL (AWK_ERR_RUNTIME, "division by zero in /=");
+    xf /= yf;
+    break;
+  case MODEQ:
+    if (yf == 0)
+      FATAL (AWK_ERR_RUNTIME, "division by zero in %%=");
+    modf (xf / yf, &v);
+    xf = xf - yf * v;
+    break;
+  case POWEQ:
+    xf = errcheck (pow (xf, yf), "pow");
+    break;
+  default:
+    FATAL (AWK_ERR_OTHER, "illegal assignment operator %d", n);
+    break;
+  }
+  return xf;
+}
+
 /// Concatenation a[0] cat a[1]
 Cell *cat (const Node::Arguments& a, int)
 {
@@ -1209,18 +1360,18 @@ Cell *dopa2 (const Node::Arguments& a, int n)
   int pair;
 
   pair = n;
-  if (pairstack[pair] == 0)
+  if (interp->pairstack[pair] == 0)
   {
     x = execute (a[0]);
     if (x->istrue ())
-      pairstack[pair] = 1;
+      interp->pairstack[pair] = 1;
     tempfree (x);
   }
-  if (pairstack[pair] == 1)
+  if (interp->pairstack[pair] == 1)
   {
     x = execute (a[1]);
     if (x->istrue ())
-      pairstack[pair] = 0;
+      interp->pairstack[pair] = 0;
     tempfree (x);
     x = execute (a[2]);
     return x;
@@ -1346,9 +1497,15 @@ Cell *instat (const Node::Arguments& a, int)
 
   tp = arrayp->arrval;
   tempfree (arrayp);
-  for (Array::Iterator cp = tp->begin(); cp != tp->end(); cp++)
+
+  /* body can add or delete elements; iterate over a copy of the names */
+  vector<string> names;
+  names.reserve (tp->length ());
+  for (auto cp : *tp)
+    names.push_back (cp->nval);
+  for (auto& name : names)
   {
-    vp->setsval (cp->nval.c_str());
+    vp->setsval (name.c_str());
     x = execute (a[2]);
     if (x->isbreak ())
     {
@@ -1369,12 +1526,11 @@ Cell *instat (const Node::Arguments& a, int)
 Cell *bltin (const Node::Arguments& a, int n)
 {
   Cell *x, *y;
-  Awkfloat u;
+  Awkfloat u = 0;
   Awkfloat tmp;
   char *p, *buf;
   Node *nextarg;
   FILE *fp;
-  void flush_all (void);
   int status = 0;
 
   x = execute (a[0]);
@@ -1414,7 +1570,7 @@ Cell *bltin (const Node::Arguments& a, int n)
     }
     break;
   case FSYSTEM:
-    fflush (stdout);    /* in case something is buffered already */
+    flush_all ();    /* in case something is buffered already */
     status = system (x->getsval ());
     u = status;
 #ifndef _MSC_VER
@@ -1480,7 +1636,10 @@ Cell *bltin (const Node::Arguments& a, int n)
     else if ((fp = openfile (FFLUSH, x->getsval ())) == NULL)
       u = EOF;
     else
+    {
       u = fflush (fp);
+      interp->dropnext ();
+    }
     break;
   default:  /* can't happen */
     FATAL (AWK_ERR_OTHER, "illegal function type %d", n);
@@ -1503,12 +1662,18 @@ Cell *bltin (const Node::Arguments& a, int n)
     a[0] - print argument(s) (linked list)
     a[1] - file or NULL
     n - redirection operator (FFLUSH, GT, APPEND, PIPE) or NULL
+
+  The whole line is assembled at the end of `outbuf` and written at once.
+  Arguments can call functions that print themselves; their lines are
+  assembled after this one and removed when written.
 */
 Cell *printstat (const Node::Arguments& a, int n)
 {
   Node *x;
   Cell *y;
   FILE *fp;
+  string& out = interp->outbuf;
+  size_t mark = out.size ();
 
   if (!n)  /* n is redirection operator, a[1] is file */
     fp = interp->files[1].fp;
@@ -1516,16 +1681,19 @@ Cell *printstat (const Node::Arguments& a, int n)
     fp = redirect (n, *a[1]);
   for (x = a[0].get(); x != NULL; x = x->nnext)
   {
+    size_t len;
+    const char* s;
     y = execute (x);
-    interp->putstr (y->getpssval (), fp);
+    s = y->getpssval (len);
+    out.append (s, len);
     tempfree (y);
     if (x->nnext == NULL)
-      interp->putstr (ORS.c_str(), fp);
+      out.append (ORS);
     else
-      interp->putstr (OFS.c_str(), fp);
+      out.append (OFS);
   }
-  if (n)
-    fflush (fp);
+  interp->putstr (out.data () + mark, out.size () - mark, fp);
+  out.resize (mark);
   if (ferror (fp))
     FATAL (AWK_ERR_OUTFILE, "write error on %s", filename (fp));
 
@@ -1586,7 +1754,7 @@ FILE *openfile (int a, const char *us)
     interp->nfiles = nnf;
     interp->files = nf;
   }
-  fflush (interp->files[1].fp);  /* force a semblance of order */
+  flush_all ();  /* force a semblance of order; lets getline see what was printed */
   m = a;
   if (a == GT)
   {
@@ -1648,10 +1816,12 @@ Cell *closefile (const Node::Arguments& a, int)
   x = execute (a[0]);
   x->getsval ();
   stat = -1;
+  interp->dropnext ();  //closed file may be read later
   for (i = 0; i < interp->nfiles; i++)
   {
     if (interp->files[i].fname && x->sval == interp->files[i].fname)
     {
+      interp->closein (interp->files[i].fp);
       if (ferror (interp->files[i].fp))
         WARNING ("i/o error occurred on %s", interp->files[i].fname);
       if (interp->files[i].mode == '|' || interp->files[i].mode == LE)
@@ -1680,6 +1850,7 @@ void flush_all (void)
   for (i = 0; i < interp->nfiles; i++)
     if (interp->files[i].fp)
       fflush (interp->files[i].fp);
+  interp->dropnext ();  //flushed data may go to the prefetched file
 }
 
 #ifdef _MSC_VER
@@ -0,0 +1,189 @@
+/*!
+  \file scan.cpp
+  \brief Separator scanning for field splitting
+
+  Separator positions are found 64 characters at a time and kept as a bit
+  mask. On x86-64 the mask is built with SSE2 or AVX2 instructions, chosen
+  at run time; other platforms use a plain loop.
+
+  (c) Mircea Neacsu 2019
+  See README file for full copyright information.
+*/
+#include <string.h>
+
+#include "awk.h"
+#include "proto.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define SCAN_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) && SCAN_SIMD
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+typedef uint64_t (*maskfn)(const char* p, const char* set);
+
+#if !SCAN_SIMD
+/// Scalar version
+static uint64_t mask_plain (const char* p, const char* set)
+{
+  uint64_t m = 0;
+  for (int i = 0; i < 64; i++)
+  {
+    char c = p[i];
+    if (c == set[0] || c == set[1] || c == set[2])
+      m |= (uint64_t)1 << i;
+  }
+  return m;
+}
+#else
+/// SSE2 version: 4 chunks of 16 characters
+static uint64_t mask_sse2 (const char* p, const char* set)
+{
+  __m128i c1 = _mm_set1_epi8 (set[0]);
+  __m128i c2 = _mm_set1_epi8 (set[1]);
+  __m128i c3 = _mm_set1_epi8 (set[2]);
+  uint64_t m = 0;
+  for (int i = 0; i < 64; i += 16)
+  {
+    __m128i v = _mm_loadu_si128 ((const __m128i*)(p + i));
+    __m128i eq = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (v, c1),
+      _mm_cmpeq_epi8 (v, c2)), _mm_cmpeq_epi8 (v, c3));
+    m |= (uint64_t)(unsigned int)_mm_movemask_epi8 (eq) << i;
+  }
+  return m;
+}
+
+/// AVX2 version: 2 chunks of 32 characters
+TARGET_AVX2
+static uint64_t mask_avx2 (const char* p, const char* set)
+{
+  __m256i c1 = _mm256_set1_epi8 (set[0]);
+  __m256i c2 = _mm256_set1_epi8 (set[1]);
+  __m256i c3 = _mm256_set1_epi8 (set[2]);
+  uint64_t m = 0;
+  for (int i = 0; i < 64; i += 32)
+  {
+    __m256i v = _mm256_loadu_si256 ((const __m256i*)(p + i));
+    __m256i eq = _mm256_or_si256 (_mm256_or_si256 (_mm256_cmpeq_epi8 (v, c1),
+      _mm256_cmpeq_epi8 (v, c2)), _mm256_cmpeq_epi8 (v, c3));
+    m |= (uint64_t)(unsigned int)_mm256_movemask_epi8 (eq) << i;
+  }
+  return m;
+}
+
+/// Check if processor and operating system support AVX2
+static bool has_avx2 ()
+{
+#ifdef _MSC_VER
+  int r[4];
+  __cpuid (r, 0);
+  if (r[0] < 7)
+    return false;
+  __cpuid (r, 1);
+  if ((r[2] & (1 << 27)) == 0 || (r[2] & (1 << 28)) == 0)
+    return false;   //no OSXSAVE or no AVX
+  if ((_xgetbv (0) & 6) != 6)
+    return false;   //OS doesn't save YMM registers
+  __cpuidex (r, 7, 0);
+  return (r[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init ();
+  return __builtin_cpu_supports ("avx2");
+#endif
+}
+#endif
+
+/// Select best mask function for this processor
+static maskfn select_mask ()
+{
+#if SCAN_SIMD
+  return has_avx2 () ? mask_avx2 : mask_sse2;
+#else
+  return mask_plain;
+#endif
+}
+
+static const maskfn sepmask = select_mask ();
+
+/// Index of lowest bit set in a non-zero value
+static inline int lowbit (uint64_t m)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+  unsigned long i;
+  _BitScanForward64 (&i, m);
+  return (int)i;
+#elif defined(_MSC_VER)
+  unsigned long i;
+  if (_BitScanForward (&i, (unsigned long)m))
+    return (int)i;
+  _BitScanForward (&i, (unsigned long)(m >> 32));
+  return (int)i + 32;
+#else
+  return __builtin_ctzll (m);
+#endif
+}
+
+/*!
+  Start scanning a new string.
+
+  \param s    string to scan
+  \param n    string length
+  \param c1, c2, c3 separator characters. Unused ones should repeat `c1`.
+*/
+void SepScanner::reset (const char* s, size_t n, char c1, char c2, char c3)
+{
+  str = s;
+  len = n;
+  set[0] = c1;
+  set[1] = c2;
+  set[2] = c3;
+  blk = SIZE_MAX;
+  mask = 0;
+}
+
+/*!
+  Find next character that is (or isn't) a separator.
+
+  \param i    starting position
+  \param sep  `true` to look for a separator, `false` for a non-separator
+  \return     position of character found or string length if none
+*/
+size_t SepScanner::next (size_t i, bool sep)
+{
+  while (i < len)
+  {
+    if (blk == SIZE_MAX || i < blk || i >= blk + 64)
+    {
+      /* compute mask for the block containing i */
+      blk = i & ~(size_t)63;
+      if (len - blk >= 64)
+        mask = sepmask (str + blk, set);
+      else
+      {
+        /* short tail; pad with something that is not a separator */
+        char tail[64], pad = 'x';
+        while (pad == set[0] || pad == set[1] || pad == set[2])
+          pad++;
+        memset (tail, pad, sizeof (tail));
+        memcpy (tail, str + blk, len - blk);
+        mask = sepmask (tail, set);
+      }
+    }
+    uint64_t m = (sep ? mask : ~mask) & (~(uint64_t)0 << (i - blk));
+    if (m)
+    {
+      i = blk + lowbit (m);
+      return i < len ? i : len;
+    }
+    i = blk + 64;
+  }
+  return len;
+}
@@ -140,9 +140,12 @@ const char *flags2str (int flags)
     { "CONST", CONST},
     { "ARR", ARR},
     { "REGEX", REGEX},
+    { "FVIEW", FVIEW},
+    { "NCHK", NCHK},
+    { "NCONV", NCONV},
     { NULL, 0 }
   };
-  static char buf[100];
+  thread_local static char buf[100];
   int i;
   char *cp = buf;
 
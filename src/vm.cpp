@@ -0,0 +1,933 @@
+/*!
+  \file vm.cpp
+  \brief Bytecode execution engine
+
+  The BEGIN, main and END parts of a program are lowered into instructions
+  for a small stack machine. Stack elements are either cells or plain
+  numbers, so arithmetic results don't need temporary cells until they are
+  stored, printed or compared with strings. With GCC and Clang instructions
+  are dispatched through computed gotos (direct threading); other compilers
+  use a switch statement.
+
+  Before compiling, a type inference pass finds global variables that are
+  provably numeric: all the stores into them produce numbers and they are
+  not used in any context that could turn them into strings or arrays. The
+  compiled code updates these variables in place, as raw doubles, without
+  pushing them on the stack or going through temporary cells.
+
+  Only the frequent statements and expressions are compiled. Anything else
+  (function calls, getline, builtin functions, redirected output, for-in
+  loops, etc.) is handed over to the parse tree walker.
+
+  (c) Mircea Neacsu 2019
+  See README file for full copyright information.
+*/
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "awk.h"
+#include "ytab.h"
+#include "proto.h"
+#include <awklib/err.h>
+#include <awklib/awk.h>
+
+using namespace std;
+
+extern Cell *True, *False, *jnext;
+
+#if defined(__GNUC__)
+#define VM_THREADED 1
+#endif
+
+/* Operation codes. Comments show stack effect. */
+enum {
+  OP_PUSH,      //  -> cell
+  OP_PUSHF,     //  -> field or record cell
+  OP_PUSHN,     //  -> number
+  OP_EVAL,      //  -> cell produced by parse tree node
+  OP_EXEC,      //  execute statement node; handle break and continue
+  OP_POP,       //  cell ->
+  OP_POPN,      //  number ->
+  OP_NUM,       //  cell -> number
+  OP_NUMV,      //  -> number (value of a variable)
+  OP_BOX,       //  number -> cell
+  OP_FIELD,     //  number -> field cell
+  OP_ARITH,     //  number number -> number
+  OP_NEG,       //  number -> number
+  OP_CMP,       //  cell cell -> True/False
+  OP_CMPN,      //  number number -> True/False
+  OP_CMPNC,     //  number cell -> True/False
+  OP_CMPCN,     //  cell number -> True/False
+  OP_NOT,       //  cell -> True/False
+  OP_CAT,       //  cell cell -> cell
+  OP_ASSIGN,    //  value_cell var_cell -> var_cell
+  OP_ASSIGNN,   //  value_number var_cell -> var_cell
+  OP_INCR,      //  var_cell -> var_cell (pre-increment/decrement)
+  OP_POSTINCR,  //  var_cell -> number (post-increment/decrement)
+  OP_STOREV,    //  number ->  (store in numeric variable)
+  OP_INCRV,     //  increment/decrement numeric variable
+  OP_ELEM,      //  array_cell subscript_cell -> element cell
+  OP_PRINT,     //  cell ->  (print followed by OFS or ORS)
+  OP_JMP,       //  jump
+  OP_JF,        //  cell ->  (jump if false)
+  OP_JT,        //  cell ->  (jump if true)
+  OP_RETURN,    //  return a jump cell (next)
+  OP_END,       //  return True
+  OP_COUNT
+};
+
+/* change of stack depth caused by each operation */
+static const int effect[OP_COUNT] = {
+  1, 1, 1, 1, 0, -1, -1, 0, 1, 0, 0, -1, 0, -1, -1, -1, -1, 0, -1, -1, -1,
+  0, 0, -1, 0, -1, -1, 0, -1, -1, 0, 0
+};
+
+/// Check if cell is a global variable that could be numeric
+static bool isvar (const Cell* c)
+{
+  return c->ctype == Cell::type::CELL
+    && !(c->flags & (CONST | PREDEF | ARR | REGEX));
+}
+
+/*!
+  Check if a value stored by an assignment is a number.
+
+  Integer constants qualify only if their text is the same as the one
+  obtained by converting the number back to string.
+*/
+static bool numstore (const Node* n)
+{
+  if (n->isvalue ())
+  {
+    const Cell* c = n->to_cell ();
+    char buf[40];
+    if ((c->flags & (CONST | NUM | STR)) == (CONST | NUM))
+      return true;  /* folded constant */
+    if ((c->flags & (CONST | NUM)) != (CONST | NUM)
+     || c->fval != floor (c->fval) || fabs (c->fval) > 1e15)
+      return false;
+    snprintf (buf, sizeof (buf), "%.30g", c->fval);
+    return c->sval == buf;
+  }
+  return n->proc == arith
+    || (n->proc == incrdecr && (n->iarg == POSTINCR || n->iarg == POSTDECR));
+}
+
+/// Record a variable reference; `ok` is false if use is not numeric
+static void mark (const Node* n, bool ok, Code::Vars& vars)
+{
+  const Cell* c = n->to_cell ();
+  if (!isvar (c))
+    return;
+  if (ok)
+    vars.emplace (c, true);
+  else
+    vars[c] = false;
+}
+
+/*!
+  Type inference for a list of nodes.
+
+  \param n      first node in list
+  \param ok     `true` if variables found in the list are only read
+  \param vars   variables found so far
+*/
+static void infer (const Node* n, bool ok, Code::Vars& vars)
+{
+  for (; n; n = n->nnext)
+  {
+    if (n->isvalue ())
+    {
+      mark (n, ok, vars);
+      continue;
+    }
+    Node::pfun p = n->proc;
+    bool rd = (p == arith || p == relop || p == boolop || p == condexpr
+      || p == cat || p == indirect || p == printstat || p == awkprintf
+      || p == awksprintf || p == bltin || p == substr || p == pastat
+      || p == ifstat || p == whilestat || p == dostat || p == forstat
+      || p == jump || p == ::array);
+    for (size_t i = 0; i < n->arg.size (); i++)
+    {
+      const Node* a = n->arg[i].get ();
+      if (!a)
+        continue;
+      if (i == 0 && a->isvalue () && (p == assign || p == incrdecr))
+        mark (a, p == incrdecr || n->iarg != ASSIGN || numstore (n->arg[1].get ()), vars);
+      else if (i == 0 && p == ::array)
+        infer (a, false, vars);
+      else
+        infer (a, rd || (p == assign && i == 1), vars);
+    }
+  }
+}
+
+/// Type inference for a list of statements
+void Code::infer (const Node* n, Vars& vars)
+{
+  ::infer (n, false, vars);
+}
+
+/*!
+  Compile a list of statements.
+
+  \param n        first statement
+  \param numvars  result of type inference
+*/
+Code::Code (const Node* n, const Vars& numvars)
+  : vars{ &numvars }
+  , depth{ 0 }
+  , linked{ false }
+{
+  stack.resize (1);
+  stmts (n);
+  emit (OP_END);
+  vars = nullptr;
+}
+
+/// Check if node is a variable found to be numeric
+bool Code::isnumvar (const Node* n) const
+{
+  if (!n->isvalue ())
+    return false;
+  auto p = vars->find (n->to_cell ());
+  return p != vars->end () && p->second;
+}
+
+/// Append an instruction and return its position
+int Code::emit (int op, int n)
+{
+  Instr i;
+  i.addr = nullptr;
+  i.op = op;
+  i.n = n;
+  i.jmp = i.jmp2 = -1;
+  i.np = nullptr;
+  code.push_back (i);
+  depth += effect[op];
+  if ((size_t)depth >= stack.size ())
+    stack.resize (depth + 1);
+  return (int)code.size () - 1;
+}
+
+/// Compile statements linked through `nnext`
+void Code::stmts (const Node* n)
+{
+  for (; n; n = n->nnext)
+    stmt (n);
+}
+
+/// Compile a statement
+void Code::stmt (const Node* n)
+{
+  int j1, j2, top;
+
+  if (n->proc == pastat)
+  {
+    if (n->arg[0])
+    {
+      cond (n->arg[0].get ());
+      j1 = emit (OP_JF);
+      stmts (n->arg[1].get ());
+      code[j1].jmp = (int)code.size ();
+    }
+    else
+      stmts (n->arg[1].get ());
+  }
+  else if (n->proc == ifstat)
+  {
+    cond (n->arg[0].get ());
+    j1 = emit (OP_JF);
+    stmts (n->arg[1].get ());
+    if (n->arg[2])
+    {
+      j2 = emit (OP_JMP);
+      code[j1].jmp = (int)code.size ();
+      stmts (n->arg[2].get ());
+      code[j2].jmp = (int)code.size ();
+    }
+    else
+      code[j1].jmp = (int)code.size ();
+  }
+  else if (n->proc == whilestat)
+  {
+    top = (int)code.size ();
+    cond (n->arg[0].get ());
+    j1 = emit (OP_JF);
+    loops.emplace_back ();
+    stmts (n->arg[1].get ());
+    code[emit (OP_JMP)].jmp = top;
+    code[j1].jmp = (int)code.size ();
+    loopend ((int)code.size (), top);
+  }
+  else if (n->proc == dostat)
+  {
+    top = (int)code.size ();
+    loops.emplace_back ();
+    stmts (n->arg[0].get ());
+    int next = (int)code.size ();
+    cond (n->arg[1].get ());
+    code[emit (OP_JT)].jmp = top;
+    loopend ((int)code.size (), next);
+  }
+  else if (n->proc == forstat)
+  {
+    stmts (n->arg[0].get ());
+    top = (int)code.size ();
+    j1 = -1;
+    if (n->arg[1])
+    {
+      cond (n->arg[1].get ());
+      j1 = emit (OP_JF);
+    }
+    loops.emplace_back ();
+    stmts (n->arg[3].get ());
+    int next = (int)code.size ();
+    stmts (n->arg[2].get ());
+    code[emit (OP_JMP)].jmp = top;
+    if (j1 >= 0)
+      code[j1].jmp = (int)code.size ();
+    loopend ((int)code.size (), next);
+  }
+  else if (n->proc == printstat && !n->iarg)
+  {
+    for (const Node* x = n->arg[0].get (); x; x = x->nnext)
+    {
+      cellexpr (x);
+      emit (OP_PRINT, x->nnext == NULL);
+    }
+  }
+  else if (n->proc == jump && (n->iarg == BREAK || n->iarg == CONTINUE)
+        && !loops.empty ())
+  {
+    j1 = emit (OP_JMP);
+    if (n->iarg == BREAK)
+      loops.back ().brk.push_back (j1);
+    else
+      loops.back ().cont.push_back (j1);
+  }
+  else if (n->proc == jump && n->iarg == NEXT)
+    code[emit (OP_RETURN)].cp = jnext;
+  else if ((n->proc == assign || n->proc == incrdecr) && isnumvar (n->arg[0].get ()))
+    store (n, false);
+  else if (n->proc == assign || n->proc == incrdecr || n->proc == arith
+        || n->proc == relop || n->proc == boolop || n->proc == condexpr
+        || n->proc == cat || n->proc == indirect)
+    emit (expr (n) ? OP_POPN : OP_POP);
+  else
+  {
+    /* statement left to the tree walker */
+    j1 = emit (OP_EXEC);
+    code[j1].np = n;
+    if (!loops.empty ())
+    {
+      loops.back ().brk.push_back (j1);
+      loops.back ().cont.push_back (j1);
+    }
+  }
+}
+
+/// Resolve pending `break` and `continue` jumps of innermost loop
+void Code::loopend (int brk, int cont)
+{
+  for (auto j : loops.back ().brk)
+    code[j].jmp = brk;
+  for (auto j : loops.back ().cont)
+  {
+    if (code[j].op == OP_EXEC)
+      code[j].jmp2 = cont;
+    else
+      code[j].jmp = cont;
+  }
+  loops.pop_back ();
+}
+
+/*!
+  Compile assignment or increment of a numeric variable.
+
+  \param n     assignment or increment/decrement node
+  \param push  `true` if result is needed
+  \return      `true` if result is a number
+*/
+bool Code::store (const Node* n, bool push)
+{
+  Cell* c = n->arg[0]->to_cell ();
+  if (n->proc == assign)
+  {
+    numexpr (n->arg[1].get ());
+    code[emit (OP_STOREV, n->iarg)].cp = c;
+  }
+  else
+  {
+    int k = (n->iarg == PREINCR || n->iarg == POSTINCR) ? 1 : -1;
+    if (push && (n->iarg == POSTINCR || n->iarg == POSTDECR))
+    {
+      code[emit (OP_NUMV)].cp = c;
+      code[emit (OP_INCRV, k)].cp = c;
+      return true;
+    }
+    code[emit (OP_INCRV, k)].cp = c;
+  }
+  if (push)
+    code[emit (OP_PUSH)].cp = c;
+  return false;
+}
+
+/// Compile a condition. Leaves a cell on the stack.
+void Code::cond (const Node* n)
+{
+  cellexpr (n);
+}
+
+/// Compile an expression that must produce a cell
+void Code::cellexpr (const Node* n)
+{
+  if (expr (n))
+    emit (OP_BOX);
+}
+
+/// Compile an expression that must produce a number
+void Code::numexpr (const Node* n)
+{
+  if (n->isvalue () && (n->to_cell ()->flags & CONST)
+   && (n->to_cell ()->flags & (NUM | NCONV)))
+    code[emit (OP_PUSHN)].f = n->to_cell ()->fval;
+  else if (n->isvalue () && n->to_cell ()->ctype == Cell::type::CELL
+        && !(n->to_cell ()->flags & CONST))
+    code[emit (OP_NUMV)].cp = n->to_cell ();
+  else if (!expr (n))
+    emit (OP_NUM);
+}
+
+/*!
+  Compile an expression.
+
+  \return `true` if the result is a number, `false` if it is a cell
+*/
+bool Code::expr (const Node* n)
+{
+  int j1, j2;
+
+  if (n->isvalue ())
+  {
+    Cell* c = n->to_cell ();
+    code[emit ((c->isfld () || c->isrec ()) ? OP_PUSHF : OP_PUSH)].cp = c;
+    return false;
+  }
+  if (n->proc == arith)
+  {
+    numexpr (n->arg[0].get ());
+    if (n->iarg == UMINUS)
+      emit (OP_NEG);
+    else if (n->iarg != UPLUS)
+    {
+      numexpr (n->arg[1].get ());
+      emit (OP_ARITH, n->iarg);
+    }
+    return true;
+  }
+  if (n->proc == relop)
+  {
+    bool lnum = expr (n->arg[0].get ());
+    bool rnum = expr (n->arg[1].get ());
+    emit (lnum ? (rnum ? OP_CMPN : OP_CMPNC) : (rnum ? OP_CMPCN : OP_CMP), n->iarg);
+    return false;
+  }
+  if (n->proc == boolop)
+  {
+    cond (n->arg[0].get ());
+    if (n->iarg == NOT)
+    {
+      emit (OP_NOT);
+      return false;
+    }
+    j1 = emit (n->iarg == AND ? OP_JF : OP_JT);
+    cond (n->arg[1].get ());
+    j2 = emit (n->iarg == AND ? OP_JF : OP_JT);
+    code[emit (OP_PUSH)].cp = (n->iarg == AND) ? True : False;
+    int j3 = emit (OP_JMP);
+    depth--;
+    code[j1].jmp = code[j2].jmp = (int)code.size ();
+    code[emit (OP_PUSH)].cp = (n->iarg == AND) ? False : True;
+    code[j3].jmp = (int)code.size ();
+    return false;
+  }
+  if (n->proc == condexpr)
+  {
+    cond (n->arg[0].get ());
+    j1 = emit (OP_JF);
+    cellexpr (n->arg[1].get ());
+    j2 = emit (OP_JMP);
+    depth--;
+    code[j1].jmp = (int)code.size ();
+    cellexpr (n->arg[2].get ());
+    code[j2].jmp = (int)code.size ();
+    return false;
+  }
+  if (n->proc == cat)
+  {
+    cellexpr (n->arg[0].get ());
+    cellexpr (n->arg[1].get ());
+    emit (OP_CAT);
+    return false;
+  }
+  if (n->proc == indirect)
+  {
+    numexpr (n->arg[0].get ());
+    emit (OP_FIELD);
+    return false;
+  }
+  if ((n->proc == assign || n->proc == incrdecr) && isnumvar (n->arg[0].get ()))
+    return store (n, true);
+  if (n->proc == assign)
+  {
+    /* right side is evaluated first */
+    bool num = expr (n->arg[1].get ());
+    cellexpr (n->arg[0].get ());
+    emit (num ? OP_ASSIGNN : OP_ASSIGN, n->iarg);
+    return false;
+  }
+  if (n->proc == incrdecr)
+  {
+    cellexpr (n->arg[0].get ());
+    if (n->iarg == PREINCR || n->iarg == PREDECR)
+    {
+      emit (OP_INCR, n->iarg == PREINCR ? 1 : -1);
+      return false;
+    }
+    emit (OP_POSTINCR, n->iarg == POSTINCR ? 1 : -1);
+    return true;
+  }
+  if (n->proc == ::array && !n->arg[1]->nnext)
+  {
+    cellexpr (n->arg[0].get ());
+    cellexpr (n->arg[1].get ());
+    emit (OP_ELEM);
+    return false;
+  }
+
+  /* anything else is evaluated by the tree walker */
+  code[emit (OP_EVAL)].np = n;
+  return false;
+}
+
+/// Build field or record if cell is one of them
+static inline void fixfld (Cell* x)
+{
+  if (x->isfld () && !interp->donefld)
+    interp->fldbld ();
+  else if (x->isrec () && !interp->donerec)
+    interp->recbld ();
+}
+
+/// Result of relational operator n given comparison result i
+static inline Cell* relval (int n, int i)
+{
+  switch (n)
+  {
+  case LT:  return (i < 0) ? True : False;
+  case LE:  return (i <= 0) ? True : False;
+  case NE:  return (i != 0) ? True : False;
+  case EQ:  return (i == 0) ? True : False;
+  case GE:  return (i >= 0) ? True : False;
+  case GT:  return (i > 0) ? True : False;
+  default:  /* can't happen */
+    FATAL (AWK_ERR_OTHER, "unknown relational operator %d", n);
+  }
+  return 0;  /*NOTREACHED*/
+}
+
+/// Numeric value of a variable
+static inline Awkfloat numval (Cell* c)
+{
+  return ((c->flags & (NUM | NCHK)) == NUM) ? c->fval : c->getfval ();
+}
+
+/// Store a number in a numeric variable (same as Cell::setfval)
+static inline void setnum (Cell* c, Awkfloat f)
+{
+  if (c->flags & (STR | CONVC | FVIEW | NCHK))
+  {
+    c->sval.clear ();
+    c->flags &= ~(STR | CONVC | FVIEW | NCHK);
+  }
+  c->flags |= NUM;
+  c->fval = f + 0.0;
+}
+
+/// Make a temporary cell with numeric value f
+static inline Cell* box (Awkfloat f)
+{
+  Cell* x = gettemp ();
+  x->setfval (f);
+  return x;
+}
+
+#if VM_THREADED
+/* computed gotos are a GNU extension; keep -pedantic builds quiet */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define OP(x)     L_##x:
+#define DISPATCH  ip++; goto *ip->addr
+#define JUMP(t)   ip = base + (t); goto *ip->addr
+#else
+#define OP(x)     case x:
+#define DISPATCH  ip++; continue
+#define JUMP(t)   ip = base + (t); continue
+#endif
+
+/*!
+  Run the code.
+
+  \return `True` at the end or the jump cell (`next`, `exit`, etc.) that
+          stopped execution
+*/
+Cell* Code::run ()
+{
+  Cell *x, *y;
+  Awkfloat f;
+  int i;
+
+#if VM_THREADED
+  static const void* const labels[OP_COUNT] = {
+    &&L_OP_PUSH, &&L_OP_PUSHF, &&L_OP_PUSHN, &&L_OP_EVAL, &&L_OP_EXEC,
+    &&L_OP_POP, &&L_OP_POPN, &&L_OP_NUM, &&L_OP_NUMV, &&L_OP_BOX,
+    &&L_OP_FIELD, &&L_OP_ARITH, &&L_OP_NEG, &&L_OP_CMP, &&L_OP_CMPN,
+    &&L_OP_CMPNC, &&L_OP_CMPCN, &&L_OP_NOT, &&L_OP_CAT, &&L_OP_ASSIGN,
+    &&L_OP_ASSIGNN, &&L_OP_INCR, &&L_OP_POSTINCR, &&L_OP_STOREV,
+    &&L_OP_INCRV, &&L_OP_ELEM, &&L_OP_PRINT, &&L_OP_JMP, &&L_OP_JF,
+    &&L_OP_JT, &&L_OP_RETURN, &&L_OP_END
+  };
+  if (!linked)
+  {
+    for (auto& in : code)
+      in.addr = labels[in.op];
+    linked = true;
+  }
+#endif
+
+  const Instr* base = code.data ();
+  const Instr* ip = base;
+  Value* sp = stack.data ();   //next free stack element
+
+#if VM_THREADED
+  goto *ip->addr;
+#else
+  for (;;)
+  {
+    switch (ip->op)
+    {
+#endif
+
+  OP(OP_PUSH)
+    (sp++)->cp = ip->cp;
+    DISPATCH;
+
+  OP(OP_PUSHF)
+    fixfld (ip->cp);
+    (sp++)->cp = ip->cp;
+    DISPATCH;
+
+  OP(OP_PUSHN)
+    (sp++)->f = ip->f;
+    DISPATCH;
+
+  OP(OP_EVAL)
+    (sp++)->cp = execnode (ip->np);
+    DISPATCH;
+
+  OP(OP_EXEC)
+    x = execnode (ip->np);
+    if (x->isbreak () && ip->jmp >= 0)
+    {
+      JUMP (ip->jmp);
+    }
+    if (x->iscont () && ip->jmp2 >= 0)
+    {
+      JUMP (ip->jmp2);
+    }
+    if (x->isjump ())
+      return x;
+    tempfree (x);
+    DISPATCH;
+
+  OP(OP_POP)
+    tempfree ((--sp)->cp);
+    DISPATCH;
+
+  OP(OP_POPN)
+    --sp;
+    DISPATCH;
+
+  OP(OP_NUM)
+    x = sp[-1].cp;
+    sp[-1].f = x->getfval ();
+    tempfree (x);
+    DISPATCH;
+
+  OP(OP_NUMV)
+    (sp++)->f = numval (ip->cp);
+    DISPATCH;
+
+  OP(OP_BOX)
+    sp[-1].cp = box (sp[-1].f);
+    DISPATCH;
+
+  OP(OP_FIELD)
+    f = sp[-1].f;  /* freebsd: defend against super large field numbers */
+    if ((Awkfloat)INT_MAX < f)
+      FATAL (AWK_ERR_LIMIT, "trying to access out of range field %g", f);
+    x = interp->fieldadr ((int)f);
+    fixfld (x);
+    sp[-1].cp = x;
+    DISPATCH;
+
+  OP(OP_ARITH)
+    --sp;
+    sp[-1].f = arithval (ip->n, sp[-1].f, sp[0].f);
+    DISPATCH;
+
+  OP(OP_NEG)
+    sp[-1].f = -sp[-1].f;
+    DISPATCH;
+
+  OP(OP_CMP)
+    --sp;
+    x = sp[-1].cp;
+    y = sp[0].cp;
+    if ((x->flags & y->flags & NUM) && !((x->flags | y->flags) & NCHK))
+    {
+      f = x->fval - y->fval;
+      i = f < 0 ? -1 : (f > 0 ? 1 : 0);
+    }
+    else
+      i = compare (x, y);
+    tempfree (x);
+    tempfree (y);
+    sp[-1].cp = relval (ip->n, i);
+    DISPATCH;
+
+  OP(OP_CMPN)
+    --sp;
+    f = sp[-1].f - sp[0].f;
+    sp[-1].cp = relval (ip->n, f < 0 ? -1 : (f > 0 ? 1 : 0));
+    DISPATCH;
+
+  OP(OP_CMPNC)
+    --sp;
+    x = box (sp[-1].f);
+    y = sp[0].cp;
+    i = compare (x, y);
+    tempfree (x);
+    tempfree (y);
+    sp[-1].cp = relval (ip->n, i);
+    DISPATCH;
+
+  OP(OP_CMPCN)
+    --sp;
+    x = sp[-1].cp;
+    y = box (sp[0].f);
+    i = compare (x, y);
+    tempfree (x);
+    tempfree (y);
+    sp[-1].cp = relval (ip->n, i);
+    DISPATCH;
+
+  OP(OP_NOT)
+    x = sp[-1].cp;
+    i = x->istrue ();
+    tempfree (x);
+    sp[-1].cp = i ? False : True;
+    DISPATCH;
+
+  OP(OP_CAT)
+    --sp;
+    x = sp[-1].cp;
+    y = sp[0].cp;
+    sp[-1].cp = gettemp ();
+    sp[-1].cp->sval = x->getsval () + string (y->getsval ());
+    sp[-1].cp->flags = STR;
+    tempfree (x);
+    tempfree (y);
+    DISPATCH;
+
+  OP(OP_ASSIGN)
+    --sp;
+    x = doassign (ip->n, sp[0].cp, sp[-1].cp);
+    fixfld (x);
+    sp[-1].cp = x;
+    DISPATCH;
+
+  OP(OP_ASSIGNN)
+    --sp;
+    x = sp[0].cp;
+    if (ip->n == ASSIGN && x->ctype == Cell::type::CELL
+     && (x->flags & (NUM | STR)) && !(x->flags & ARR))
+    {
+      /* plain variable; same result as copying a numeric temporary cell */
+      x->sval.clear ();
+      x->flags &= ~(NUM | STR | FVIEW | NCHK);
+      x->flags |= NUM;
+      x->fval = sp[-1].f + 0.0;
+    }
+    else
+    {
+      x = doassign (ip->n, x, box (sp[-1].f));
+      fixfld (x);
+    }
+    sp[-1].cp = x;
+    DISPATCH;
+
+  OP(OP_INCR)
+    x = sp[-1].cp;
+    x->setfval (x->getfval () + ip->n);
+    fixfld (x);
+    DISPATCH;
+
+  OP(OP_POSTINCR)
+    x = sp[-1].cp;
+    f = x->getfval ();
+    x->setfval (f + ip->n);
+    tempfree (x);
+    sp[-1].f = f;
+    DISPATCH;
+
+  OP(OP_STOREV)
+    x = ip->cp;
+    f = (--sp)->f;
+    if (x->flags & ARR)
+      doassign (ip->n, x, box (f));   //let it complain
+    else if (ip->n == ASSIGN)
+    {
+      /* same result as copying a numeric temporary cell */
+      x->sval.clear ();
+      x->flags &= ~(NUM | STR | FVIEW | NCHK);
+      x->flags |= NUM;
+      x->fval = f + 0.0;
+    }
+    else
+      setnum (x, assignval (ip->n, numval (x), f));
+    DISPATCH;
+
+  OP(OP_INCRV)
+    x = ip->cp;
+    if (x->flags & ARR)
+      funnyvar (x, "assign to");
+    setnum (x, numval (x) + ip->n);
+    DISPATCH;
+
+  OP(OP_ELEM)
+    --sp;
+    sp[-1].cp = element (sp[-1].cp, sp[0].cp);
+    DISPATCH;
+
+  OP(OP_PRINT)
+    {
+      /* items are collected in outbuf; the last one writes the line */
+      size_t len;
+      string& out = interp->outbuf;
+      x = (--sp)->cp;
+      const char* s = x->getpssval (len);
+      out.append (s, len);
+      tempfree (x);
+      if (ip->n)
+      {
+        FILE* fp = interp->files[1].fp;
+        out.append (ORS);
+        interp->putstr (out.data (), out.size (), fp);
+        out.clear ();
+        if (ferror (fp))
+          FATAL (AWK_ERR_OUTFILE, "write error on %s", filename (fp));
+      }
+      else
+        out.append (OFS);
+    }
+    DISPATCH;
+
+  OP(OP_JMP)
+    JUMP (ip->jmp);
+
+  OP(OP_JF)
+    x = (--sp)->cp;
+    i = x->istrue ();
+    tempfree (x);
+    if (!i)
+    {
+      JUMP (ip->jmp);
+    }
+    DISPATCH;
+
+  OP(OP_JT)
+    x = (--sp)->cp;
+    i = x->istrue ();
+    tempfree (x);
+    if (i)
+    {
+      JUMP (ip->jmp);
+    }
+    DISPATCH;
+
+  OP(OP_RETURN)
+    return ip->cp;
+
+  OP(OP_END)
+    return True;
+
+#if !VM_THREADED
+    }
+  }
+#endif
+}
+
+#if VM_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+/// Compile BEGIN, main rules and END parts of the program
+void Interpreter::makecode ()
+{
+  Code::Vars vars;
+
+  /* functions can change global variables too */
+  for (auto p : *symtab)
+  {
+    if (p->ctype == Cell::type::CFUNC && p->nodeptr)
+      Code::infer (p->nodeptr, vars);
+  }
+  for (int i = 0; i < 3; i++)
+    Code::infer (prog_root->arg[i].get (), vars);
+  for (int i = 0; i < 3; i++)
+    code[i] = make_unique<Code> (prog_root->arg[i].get (), vars);
+}
+
+/// Run compiled program. Mirrors program() function.
+void Interpreter::runcode ()
+{
+  Cell* x;
+  bool exit_seen = false;
+
+  if (prog_root->arg[0])
+  {    /* BEGIN */
+    x = code[0]->run ();
+    if (x->isexit ())
+      exit_seen = true;
+    else if (x->isjump ())
+      FATAL (AWK_ERR_SYNTAX, "illegal break, continue, next or nextfile from BEGIN");
+  }
+  if (!exit_seen && (prog_root->arg[1] || prog_root->arg[2]))
+  {
+    while (getrec (fldtab[0].get ()))
+    {
+      x = code[1]->run ();
+      if (x->isexit ())
+        break;
+    }
+  }
+  if (prog_root->arg[2])
+  {    /* END */
+    x = code[2]->run ();
+    if (x->isbreak () || x->isnext () || x->iscont ())
+      FATAL (AWK_ERR_SYNTAX, "illegal break, continue, next or nextfile from END");
+  }
+}